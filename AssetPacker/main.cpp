@@ -0,0 +1,37 @@
+// packs an asset folder into a single archive for ursa::pack::mount
+// usage: AssetPacker [-c] <asset folder> <archive>
+
+#include "URSA/pack.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+int main(int argc, char *argv[]) {
+	bool compress = false;
+	const char *paths[2] = { nullptr, nullptr };
+	int count = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0) {
+			compress = true;
+		} else if (count < 2) {
+			paths[count++] = argv[i];
+		} else {
+			count++;
+		}
+	}
+
+	if (count != 2) {
+		fprintf(stderr, "usage: %s [-c] <asset folder> <archive>\n", argv[0]);
+		fprintf(stderr, "  -c  lz compress files where it saves space\n");
+		return 2;
+	}
+
+	std::string error;
+	if (!ursa::pack::build(paths[0], paths[1], compress, &error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -7,6 +7,13 @@
 #endif
 
 #include "URSA.h"
+#include "URSA/file.h"
+#include "URSA/jobs.h"
+#include "URSA/lz.h"
+#include "URSA/pack.h"
+#include "URSA/spscqueue.h"
+#include "URSA/texcompress.h"
+#include "URSA/utf8.h"
 
 #include <SDL2/SDL.h>
 #include <glad/glad.h>
@@ -14,6 +21,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define URSA_SSE2
+#endif
+
+// compressed formats, in case the GL loader was generated without the extensions
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_RECT_PACK_IMPLEMENTATION
 #define STB_TRUETYPE_IMPLEMENTATION
@@ -21,8 +41,14 @@
 #include <stb_rect_pack.h>
 #include <stb_truetype.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <fstream>
 
@@ -33,8 +59,15 @@ namespace ursa {
 		static SDL_Window* g_window = nullptr;
 		static SDL_GLContext g_glContext;
 
+		// frames completed so far, used to keep resources drawn in the current frame from being evicted
+		static uint64_t g_frame = 0;
+		// arrival of the event being dispatched, see input_timestamp()
+		static uint64_t g_eventTimestamp = 0;
+
 		static unsigned int g_VAO = 0;
 		static unsigned int g_VBO = 0;
+		// element buffer of g_VAO, only draw_indexed uses it
+		static unsigned int g_IBO = 0;
 		static unsigned int g_shader = 0;
 
 		// TODO glBindAttribLocation instead of layout qualifiers, for legacy support?
@@ -45,13 +78,15 @@ layout(location = 1) in vec2 in_uv;
 layout(location = 2) in vec4 in_color;
 
 uniform mat4 transform;
+// lets retained geometry be placed without rebuilding it
+uniform vec3 offset;
 
 out vec2 uv;
 out vec4 color;
 
 void main()
 {
-	gl_Position = transform * vec4(in_pos, 1.0);
+	gl_Position = transform * vec4(in_pos + offset, 1.0);
 	uv = in_uv;
 	color = in_color;
 })";
@@ -66,12 +101,20 @@ out vec4 FragColor;
 uniform sampler2D tex;
 uniform bool use_tex;
 uniform bool alpha_tex;
+uniform bool distance_tex;
 
 void main()
 {
-	if (use_tex) {
+	// untextured vertices in a textured draw carry a uv far below anything a texture would use
+	if (use_tex && uv.x > -32768.0f) {
 		vec4 texcolor = texture(tex, uv);
-		if (alpha_tex) {
+		if (distance_tex) {
+			// the edge sits at 0.5, antialias over about one screen pixel whatever the scale
+			// fwidth is 0 where the distance doesn't change, and smoothstep is undefined for equal edges
+			float width = max(fwidth(texcolor.r) * 0.5f, 1e-4f);
+			float alpha = smoothstep(0.5f - width, 0.5f + width, texcolor.r);
+			FragColor = vec4(1.0f, 1.0f, 1.0f, alpha) * color;
+		} else if (alpha_tex) {
 			FragColor = vec4(1.0f, 1.0f, 1.0f, texcolor.r) * color;
 		} else {
 			FragColor = texcolor * color;
@@ -108,6 +151,9 @@ void main()
 			glBindVertexArray(g_VAO);
 
 			glGenBuffers(1, &g_VBO);
+			// the element buffer binding is part of the VAO state
+			glGenBuffers(1, &g_IBO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_IBO);
 
 			glBindBuffer(GL_ARRAY_BUFFER, g_VBO);
 			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, pos));
@@ -196,6 +242,8 @@ void main()
 		}
 
 		void quit() {
+			jobs::shutdown();
+
 			SDL_DestroyWindow(g_window);
 			g_window = NULL;
 
@@ -205,21 +253,11 @@ void main()
 
 	// ...
 
-	std::unique_ptr<char[]> file_contents(const char *filename) {
-		std::ifstream file(filename, std::ios::binary | std::ios::ate);
-		int filesize = (int)file.tellg();
-		file.seekg(0, std::ios::beg);
-		auto buf = std::make_unique<char[]>(filesize);
-		file.read(buf.get(), filesize);
-		if (!file) {
-			// TODO handle loading error
-			assert(0);
-		}
-		return buf;
+	namespace internal {
+		// defined with the texture registry further down
+		void set_texture_kind(const TextureHandle &tex, TextureHandle::TextureKind kind);
 	}
 
-	// ...
-
 	struct chardatas {
 		FontAtlas::FontInfo fontinfo;
 		stbtt_packedchar data[128];
@@ -228,60 +266,574 @@ void main()
 	class FontAtlasImpl {
 	public:
 		void add_truetype(const char *filename, float font_size) {
-			m_sourcelist.emplace_back(filename, std::vector<float>{font_size});
+			m_sourcelist.push_back({ filename, std::vector<float>{font_size}, 0.0f });
 		}
 		void add_truetype(const char *filename, std::initializer_list<float> font_sizes) {
-			m_sourcelist.emplace_back(filename, std::vector<float>{font_sizes});
+			m_sourcelist.push_back({ filename, std::vector<float>{font_sizes}, 0.0f });
 		}
+		void add_truetype_sdf(const char *filename, std::initializer_list<float> font_sizes, float sdf_size) {
+			assert(sdf_size > 0.0f);
+			m_sourcelist.push_back({ filename, std::vector<float>{font_sizes}, sdf_size });
+		}
+
+		void bake(int texwidth, int texheight, const char *cachefile) {
+			// font files stay loaded after baking, glyphs outside the baked range are rasterized from them on demand
+			m_epoch++;
+			m_fontfiles.clear();
+			m_fonts.clear();
+			m_sdfFaces.clear();
+			m_glyphs.clear();
+			for (auto &page : m_pages)
+				reset_page(page);
+
+			for (const auto &source : m_sourcelist) {
+				// entries naming the same file share one buffer
+				pack::Span &fontbuf = m_fontfiles[normalize_path(source.filename.c_str())];
+				if (!fontbuf.valid())
+					fontbuf = pack::load(source.filename.c_str());
+				// TODO handle loading error
+				assert(fontbuf.valid());
+
+				stbtt_fontinfo fontinfo;
+				stbtt_InitFont(&fontinfo, fontbuf.data, 0);
+
+				int sdfFace = -1;
+				if (source.sdfSize > 0.0f) {
+					sdfFace = (int)m_sdfFaces.size();
+					m_sdfFaces.push_back({ fontinfo, stbtt_ScaleForPixelHeight(&fontinfo, source.sdfSize), source.sdfSize });
+				}
+				for (float size : source.sizes)
+					m_fonts.push_back({ fontinfo, size, stbtt_ScaleForPixelHeight(&fontinfo, size), sdfFace });
+			}
+
+			uint64_t key = cache_key(texwidth, texheight);
+			if (cachefile && load_cache(cachefile, key, texwidth, texheight)) {
+				build_metrics();
+				return;
+			}
 
-		void bake(int texwidth, int texheight) {
 			std::unique_ptr<unsigned char[]> fontbitmap = std::make_unique<unsigned char[]>(texwidth*texheight);
 			stbtt_pack_context spc;
 			stbtt_PackBegin(&spc, fontbitmap.get(), texwidth, texheight, 0, 1, nullptr);
 
-			for (const auto &t : m_sourcelist) {
-				const auto &filename = std::get<0>(t);
-				const auto &sizes = std::get<1>(t);
+			// rects are gathered and packed one font at a time in order, exactly like stbtt_PackFontRange would,
+			// so the layout doesn't change; only rasterizing into the packed rects runs in parallel
+			std::vector<stbtt_pack_range> ranges(m_fonts.size());
+			std::vector<std::vector<stbrp_rect>> rects(m_fonts.size());
 
-				// TODO avoid conversion, use std::string everywhere?
-				auto fontbuf = file_contents(filename.c_str());
-				stbtt_fontinfo fontinfo;
-				stbtt_InitFont(&fontinfo, (unsigned char*)fontbuf.get(), 0);
+			m_chardatas.clear();
+			m_chardatas.reserve(m_fonts.size());
+			for (size_t i = 0; i < m_fonts.size(); i++) {
+				const auto &font = m_fonts[i];
 				int ascent{ 0 }, descent{ 0 }, gap{ 0 }; // in FUnits
-				stbtt_GetFontVMetrics(&fontinfo, &ascent, &descent, &gap);
+				stbtt_GetFontVMetrics(&font.info, &ascent, &descent, &gap);
+
+				m_chardatas.push_back({ { ascent*font.scale, descent*font.scale, gap*font.scale }, {0} });
+				// distance field glyphs all come from the glyph cache
+				if (font.sdfFace >= 0)
+					continue;
+
+				stbtt_pack_range &range = ranges[i];
+				range.font_size = font.size;
+				range.first_unicode_codepoint_in_range = 32;
+				range.array_of_unicode_codepoints = nullptr;
+				range.num_chars = 96;
+				range.chardata_for_range = m_chardatas.back().data + 32;
+				stbtt_PackSetOversampling(&spc, 1, 1);
+
+				rects[i].resize(range.num_chars);
+				int count = stbtt_PackFontRangesGatherRects(&spc, &font.info, &range, 1, rects[i].data());
+				rects[i].resize(count);
+				stbtt_PackFontRangesPackRects(&spc, rects[i].data(), count);
+			}
 
-				for (float size : sizes) {
-					float scale = stbtt_ScaleForPixelHeight(&fontinfo, size);
-					m_chardatas.push_back({ { ascent*scale, descent*scale, gap*scale }, {0} });
-					stbtt_PackSetOversampling(&spc, 1, 1);
-					stbtt_PackFontRange(&spc, (unsigned char *)fontbuf.get(), 0, size, 32, 96, m_chardatas.back().data + 32);
-				}
+			// gathering yields one rect per codepoint, so a range splits into independent slices of glyphs
+			struct Slice { int font, first, count; };
+			const int sliceGlyphs = 16;
+			std::vector<Slice> slices;
+			for (size_t i = 0; i < rects.size(); i++) {
+				for (int first = 0; first < (int)rects[i].size(); first += sliceGlyphs)
+					slices.push_back({ (int)i, first, std::min(sliceGlyphs, (int)rects[i].size() - first) });
 			}
 
+			jobs::parallel_for((int)slices.size(), [&](int n) {
+				const Slice &slice = slices[n];
+				stbtt_pack_range range = ranges[slice.font];
+				range.first_unicode_codepoint_in_range += slice.first;
+				range.num_chars = slice.count;
+				range.chardata_for_range += slice.first;
+				// rendering temporarily writes the oversampling settings into the context, keep a copy per slice
+				stbtt_pack_context local = spc;
+				stbtt_PackFontRangesRenderIntoRects(&local, &m_fonts[slice.font].info, &range, 1, rects[slice.font].data() + slice.first);
+			});
+
 			stbtt_PackEnd(&spc);
 
-			m_tex = ursa::texture8bpp(texwidth, texheight, fontbitmap.get());
+			if (cachefile)
+				write_cache(cachefile, key, texwidth, texheight, fontbitmap.get());
+			upload(texwidth, texheight, fontbitmap.get());
+			build_metrics();
 		}
 
-		ursa::TextureHandle tex() const { return m_tex; }
+		void glyph_cache(int pageSize, int maxPages) {
+			assert(pageSize > 0 && maxPages > 0);
+			m_epoch++;
+			m_pageSize = pageSize;
+			m_maxPages = maxPages;
+			m_glyphs.clear();
+			for (auto &page : m_pages)
+				texture_release(page.tex);
+			m_pages.clear();
+		}
 
-		FontAtlas::GlyphInfo glyphInfo(int fontIndex, int codepoint) const {
-			const auto &c = m_chardatas[fontIndex].data[codepoint];
-			return {
-				{{c.x0, c.y0}, {c.x1 - c.x0, c.y1 - c.y0}},
-				{{c.xoff, c.yoff}, {c.xoff2 - c.xoff, c.yoff2 - c.yoff}},
-				c.xadvance
-			};
+		unsigned int glyph_epoch() const { return m_epoch; }
+
+		ursa::TextureHandle tex(int page) const {
+			assert(page >= 0 && page <= (int)m_pages.size());
+			return page ? m_pages[page - 1].tex : m_tex;
+		}
+
+		void touch(int page) {
+			assert(page >= 0 && page <= (int)m_pages.size());
+			if (page)
+				m_pages[page - 1].lastUsed = internal::g_frame;
+		}
+
+		FontAtlas::GlyphInfo glyphInfo(int fontIndex, int codepoint) {
+			assert(fontIndex >= 0 && (unsigned)fontIndex < m_chardatas.size());
+			const FontSource &font = m_fonts[fontIndex];
+			if ((unsigned)codepoint < 128 && font.sdfFace < 0) {
+				const auto &c = m_chardatas[fontIndex].data[codepoint];
+				const GlyphMetrics &m = m_metrics[fontIndex];
+				return {
+					{{c.x0, c.y0}, {c.x1 - c.x0, c.y1 - c.y0}},
+					{{m.x0[codepoint], m.y0[codepoint]}, {m.x1[codepoint] - m.x0[codepoint], m.y1[codepoint] - m.y0[codepoint]}},
+					m.advance[codepoint],
+					0
+				};
+			}
+
+			// distance field glyphs are shared by every size of the face
+			bool sdf = font.sdfFace >= 0;
+			uint64_t key = ((uint64_t)sdf << 63) | ((uint64_t)(sdf ? font.sdfFace : fontIndex) << 32) | (uint32_t)codepoint;
+			auto found = m_glyphs.find(key);
+			if (found == m_glyphs.end()) {
+				CachedGlyph glyph;
+				bool placed = sdf ? rasterize_sdf(font.sdfFace, codepoint, glyph) : rasterize(fontIndex, codepoint, glyph);
+				// no room this frame, try again next time
+				if (!placed) {
+					glyph.info.pending = true;
+					return glyph.info;
+				}
+				found = m_glyphs.emplace(key, glyph).first;
+			}
+			CachedGlyph &glyph = found->second;
+			glyph.lastUsed = internal::g_frame;
+			if (glyph.info.page)
+				m_pages[glyph.info.page - 1].lastUsed = internal::g_frame;
+			if (!sdf)
+				return glyph.info;
+
+			FontAtlas::GlyphInfo info = glyph.info;
+			float k = font.size / m_sdfFaces[font.sdfFace].size;
+			info.bounds = Rect(info.bounds.pos * k, info.bounds.size * k);
+			info.xadvance *= k;
+			return info;
 		}
 
 		FontAtlas::FontInfo fontInfo(int fontIndex) const {
 			assert(fontIndex >= 0 && (unsigned)fontIndex < m_chardatas.size());
 			return m_chardatas[fontIndex].fontinfo;
 		}
+
+		float kerning(int fontIndex, int first, int second) const {
+			assert(fontIndex >= 0 && (unsigned)fontIndex < m_metrics.size());
+			const GlyphMetrics &m = m_metrics[fontIndex];
+			if ((unsigned)first < 128 && (unsigned)second < 128)
+				return m.kern.empty() ? 0.0f : m.kern[first * 128 + second];
+			const FontSource &font = m_fonts[fontIndex];
+			return stbtt_GetCodepointKernAdvance(&font.info, first, second) * font.scale;
+		}
+
+		float measure_run(int fontIndex, const char *text, size_t length) const {
+			assert(fontIndex >= 0 && (unsigned)fontIndex < m_metrics.size());
+			const GlyphMetrics &m = m_metrics[fontIndex];
+			const FontSource &font = m_fonts[fontIndex];
+			float width = 0.0f;
+			int prev = -1;
+			const char *p = text;
+			const char *end = text + length;
+			while (p < end) {
+				size_t run = utf8::ascii_run(p, end - p);
+				if (run) {
+					const unsigned char *s = reinterpret_cast<const unsigned char*>(p);
+					width += sum_advances(m, s, run);
+					if (!m.kern.empty()) {
+						if (prev >= 0)
+							width += kerning(fontIndex, prev, s[0]);
+						width += sum_kerning(m, s, run);
+					}
+					prev = s[run - 1];
+					p += run;
+				}
+				if (p < end) {
+					// outside the tables, ask the font directly instead of rasterizing through glyphInfo
+					int codepoint = (int)utf8::decode(p, end);
+					int advance = 0, lsb = 0;
+					stbtt_GetCodepointHMetrics(&font.info, codepoint, &advance, &lsb);
+					width += advance * font.scale;
+					if (prev >= 0)
+						width += kerning(fontIndex, prev, codepoint);
+					prev = codepoint;
+				}
+			}
+			return width;
+		}
 	private:
+		// flat per-font tables for the ASCII range, measuring reads these instead of going through glyphInfo
+		struct GlyphMetrics {
+			float advance[128];
+			// glyph box relative to the pen position on the baseline
+			float x0[128], y0[128], x1[128], y1[128];
+			// adjustment between ASCII pairs indexed [first * 128 + second], empty when the font has no kerning
+			std::vector<float> kern;
+		};
+
+		void build_metrics() {
+			m_metrics.assign(m_fonts.size(), GlyphMetrics());
+			for (size_t i = 0; i < m_fonts.size(); i++) {
+				const FontSource &font = m_fonts[i];
+				GlyphMetrics &m = m_metrics[i];
+				for (int c = 0; c < 128; c++) {
+					if (font.sdfFace < 0) {
+						// baked glyphs, these match the quads exactly
+						const auto &pc = m_chardatas[i].data[c];
+						m.advance[c] = pc.xadvance;
+						m.x0[c] = pc.xoff;
+						m.y0[c] = pc.yoff;
+						m.x1[c] = pc.xoff2;
+						m.y1[c] = pc.yoff2;
+						continue;
+					}
+					int advance = 0, lsb = 0;
+					stbtt_GetCodepointHMetrics(&font.info, c, &advance, &lsb);
+					int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+					stbtt_GetCodepointBitmapBox(&font.info, c, font.scale, font.scale, &x0, &y0, &x1, &y1);
+					m.advance[c] = advance * font.scale;
+					m.x0[c] = (float)x0;
+					m.y0[c] = (float)y0;
+					m.x1[c] = (float)x1;
+					m.y1[c] = (float)y1;
+				}
+
+				// only printable pairs can kern, most fonts have none at all and skip the table
+				bool any = false;
+				std::vector<float> kern(128 * 128, 0.0f);
+				for (int a = 32; a < 128; a++) {
+					for (int b = 32; b < 128; b++) {
+						int k = stbtt_GetCodepointKernAdvance(&font.info, a, b);
+						if (k) {
+							kern[a * 128 + b] = k * font.scale;
+							any = true;
+						}
+					}
+				}
+				if (any)
+					m.kern = std::move(kern);
+			}
+		}
+
+		// four lanes of table lookups so the adds don't serialize on a single accumulator
+		static float sum_advances(const GlyphMetrics &m, const unsigned char *s, size_t n) {
+			size_t i = 0;
+			float total = 0.0f;
+#ifdef URSA_SSE2
+			__m128 acc = _mm_setzero_ps();
+			for (; i + 4 <= n; i += 4)
+				acc = _mm_add_ps(acc, _mm_setr_ps(m.advance[s[i]], m.advance[s[i + 1]], m.advance[s[i + 2]], m.advance[s[i + 3]]));
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, acc);
+			total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+			for (; i < n; i++)
+				total += m.advance[s[i]];
+			return total;
+		}
+
+		// kerning between the neighbours inside the run
+		static float sum_kerning(const GlyphMetrics &m, const unsigned char *s, size_t n) {
+			const float *kern = m.kern.data();
+			size_t i = 1;
+			float total = 0.0f;
+#ifdef URSA_SSE2
+			__m128 acc = _mm_setzero_ps();
+			for (; i + 4 <= n; i += 4) {
+				acc = _mm_add_ps(acc, _mm_setr_ps(
+					kern[s[i - 1] * 128 + s[i]], kern[s[i] * 128 + s[i + 1]],
+					kern[s[i + 1] * 128 + s[i + 2]], kern[s[i + 2] * 128 + s[i + 3]]));
+			}
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, acc);
+			total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+			for (; i < n; i++)
+				total += kern[s[i - 1] * 128 + s[i]];
+			return total;
+		}
+
+		struct FontSource {
+			stbtt_fontinfo info;
+			float size;
+			float scale;
+			// index into m_sdfFaces for distance field fonts, -1 otherwise
+			int sdfFace;
+		};
+
+		struct SdfFace {
+			stbtt_fontinfo info;
+			float scale;
+			float size;
+		};
+
+		struct CachedGlyph {
+			FontAtlas::GlyphInfo info;
+			uint64_t lastUsed;
+		};
+
+		// glyphs rasterized on demand go to pages packed in shelves: rows of glyphs of similar height
+		struct Shelf {
+			int y, height, x;
+		};
+
+		struct GlyphPage {
+			TextureHandle tex;
+			// distance field and coverage glyphs need different shading so they never share a page
+			bool sdf = false;
+			std::vector<Shelf> shelves;
+			int bottom = 0;
+			uint64_t lastUsed = 0;
+		};
+
+		void reset_page(GlyphPage &page) {
+			page.shelves.clear();
+			page.bottom = 0;
+		}
+
+		bool allocate(GlyphPage &page, int w, int h, int &x, int &y) {
+			Shelf *best = nullptr;
+			for (auto &shelf : page.shelves) {
+				// don't waste tall shelves on short glyphs
+				if (shelf.height < h || shelf.height > h + h / 2 + 2 || shelf.x + w > m_pageSize)
+					continue;
+				if (!best || shelf.height < best->height)
+					best = &shelf;
+			}
+			if (!best) {
+				if (page.bottom + h > m_pageSize || w > m_pageSize)
+					return false;
+				page.shelves.push_back({ page.bottom, h, 0 });
+				page.bottom += h;
+				best = &page.shelves.back();
+			}
+			x = best->x;
+			y = best->y;
+			best->x += w;
+			return true;
+		}
+
+		// returns the page number (1-based like GlyphInfo::page), or 0 if every page is in use this frame
+		int place(int w, int h, bool sdf, int &x, int &y) {
+			for (size_t i = 0; i < m_pages.size(); i++) {
+				if (m_pages[i].sdf == sdf && allocate(m_pages[i], w, h, x, y))
+					return (int)i + 1;
+			}
+
+			GlyphPage *target = nullptr;
+			if ((int)m_pages.size() < m_maxPages) {
+				std::vector<uint8_t> blank((size_t)m_pageSize * m_pageSize, 0);
+				TextureDesc desc;
+				desc.mips = TextureDesc::Mips::None;
+				desc.wrap = TextureDesc::Wrap::Clamp;
+				m_pages.emplace_back();
+				target = &m_pages.back();
+				target->tex = texture8bpp(m_pageSize, m_pageSize, blank.data(), desc);
+			} else {
+				// evict the coldest page wholesale, its glyphs get rasterized again when they show up
+				for (auto &page : m_pages) {
+					if (page.lastUsed < internal::g_frame && (!target || page.lastUsed < target->lastUsed))
+						target = &page;
+				}
+				if (!target)
+					return 0;
+				m_epoch++;
+				int evicted = (int)(target - m_pages.data()) + 1;
+				for (auto it = m_glyphs.begin(); it != m_glyphs.end();) {
+					if (it->second.info.page == evicted)
+						it = m_glyphs.erase(it);
+					else
+						++it;
+				}
+				reset_page(*target);
+			}
+
+			target->sdf = sdf;
+			internal::set_texture_kind(target->tex, sdf ? TextureHandle::TextureKind::Distance : TextureHandle::TextureKind::Alpha);
+			if (!allocate(*target, w, h, x, y))
+				return 0;
+			return (int)(target - m_pages.data()) + 1;
+		}
+
+		bool rasterize(int fontIndex, int codepoint, CachedGlyph &glyph) {
+			const FontSource &font = m_fonts[fontIndex];
+			int advance = 0, lsb = 0;
+			stbtt_GetCodepointHMetrics(&font.info, codepoint, &advance, &lsb);
+			int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+			stbtt_GetCodepointBitmapBox(&font.info, codepoint, font.scale, font.scale, &x0, &y0, &x1, &y1);
+
+			glyph = { { Rect(), Rect((float)x0, (float)y0, (float)(x1 - x0), (float)(y1 - y0)), advance * font.scale, 0 }, internal::g_frame };
+			int w = x1 - x0, h = y1 - y0;
+			if (w <= 0 || h <= 0)
+				return true;
+
+			// one pixel of padding keeps neighbours out of the filtered edges
+			int x = 0, y = 0;
+			int page = place(w + 1, h + 1, false, x, y);
+			if (!page) {
+				glyph.info.bounds = Rect();
+				return false;
+			}
+
+			std::vector<uint8_t> bitmap((size_t)(w + 1) * (h + 1), 0);
+			stbtt_MakeCodepointBitmap(&font.info, bitmap.data(), w, h, w + 1, font.scale, font.scale, codepoint);
+			texture_update(m_pages[page - 1].tex, Rect((float)x, (float)y, (float)(w + 1), (float)(h + 1)), bitmap.data(), false);
+
+			glyph.info.crop = Rect((float)x, (float)y, (float)w, (float)h);
+			glyph.info.page = page;
+			return true;
+		}
+
+		bool rasterize_sdf(int face, int codepoint, CachedGlyph &glyph) {
+			const SdfFace &sdf = m_sdfFaces[face];
+			// the field reaches padding pixels out from the edge, enough for outlines and glows at moderate scales
+			int padding = std::max(2, (int)(sdf.size / 8));
+			int advance = 0, lsb = 0;
+			stbtt_GetCodepointHMetrics(&sdf.info, codepoint, &advance, &lsb);
+			glyph = { { Rect(), Rect(), advance * sdf.scale, 0 }, internal::g_frame };
+
+			int w = 0, h = 0, xoff = 0, yoff = 0;
+			unsigned char *field = stbtt_GetCodepointSDF(&sdf.info, sdf.scale, codepoint, padding, 128, 128.0f / padding, &w, &h, &xoff, &yoff);
+			if (!field)
+				return true;
+
+			int x = 0, y = 0;
+			int page = place(w + 1, h + 1, true, x, y);
+			if (page) {
+				std::vector<uint8_t> bitmap((size_t)(w + 1) * (h + 1), 0);
+				for (int row = 0; row < h; row++)
+					memcpy(&bitmap[(size_t)row * (w + 1)], field + (size_t)row * w, w);
+				texture_update(m_pages[page - 1].tex, Rect((float)x, (float)y, (float)(w + 1), (float)(h + 1)), bitmap.data(), false);
+				glyph.info.crop = Rect((float)x, (float)y, (float)w, (float)h);
+				glyph.info.bounds = Rect((float)xoff, (float)yoff, (float)w, (float)h);
+				glyph.info.page = page;
+			}
+			stbtt_FreeSDF(field, nullptr);
+			return page != 0;
+		}
+
+		// cache file: header, the chardatas of every font and size, then the 8bpp bitmap
+		struct CacheHeader {
+			char magic[4];
+			uint32_t version;
+			uint64_t key;
+			uint32_t width, height;
+			uint32_t fontCount;
+			uint32_t reserved;
+		};
+
+		static constexpr char cacheMagic[4] = { 'U', 'F', 'C', '1' };
+		static const uint32_t cacheVersion = 1;
+
+		// everything the baked result depends on, font files are identified by their contents
+		uint64_t cache_key(int texwidth, int texheight) {
+			const uint32_t params[] = { cacheVersion, (uint32_t)sizeof(chardatas), (uint32_t)texwidth, (uint32_t)texheight, 32, 96 /*codepoint range*/, 1, 1 /*oversampling*/ };
+			uint64_t key = hash_bytes(params, sizeof(params));
+			for (const auto &source : m_sourcelist) {
+				const auto &sizes = source.sizes;
+				const pack::Span &fontbuf = m_fontfiles[normalize_path(source.filename.c_str())];
+				uint64_t fileHash = hash_bytes(fontbuf.data, fontbuf.size);
+				uint32_t count = (uint32_t)sizes.size();
+				key = hash_bytes(&fileHash, sizeof(fileHash), key);
+				key = hash_bytes(&count, sizeof(count), key);
+				key = hash_bytes(sizes.data(), sizes.size() * sizeof(float), key);
+				key = hash_bytes(&source.sdfSize, sizeof(source.sdfSize), key);
+			}
+			return key;
+		}
+
+		bool load_cache(const char *cachefile, uint64_t key, int texwidth, int texheight) {
+			MappedFile cache(cachefile);
+			if (!cache.valid() || cache.size() < sizeof(CacheHeader))
+				return false;
+			const CacheHeader &h = *reinterpret_cast<const CacheHeader*>(cache.data());
+			size_t expected = sizeof(CacheHeader) + (size_t)h.fontCount * sizeof(chardatas) + (size_t)texwidth * texheight;
+			if (memcmp(h.magic, cacheMagic, sizeof(cacheMagic)) != 0 || h.version != cacheVersion || h.key != key ||
+				h.width != (uint32_t)texwidth || h.height != (uint32_t)texheight || cache.size() != expected)
+				return false;
+
+			const chardatas *fonts = reinterpret_cast<const chardatas*>(cache.data() + sizeof(CacheHeader));
+			m_chardatas.assign(fonts, fonts + h.fontCount);
+			upload(texwidth, texheight, reinterpret_cast<const uint8_t*>(fonts + h.fontCount));
+			return true;
+		}
+
+		void write_cache(const char *cachefile, uint64_t key, int texwidth, int texheight, const uint8_t *bitmap) const {
+			CacheHeader h;
+			memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+			h.version = cacheVersion;
+			h.key = key;
+			h.width = texwidth;
+			h.height = texheight;
+			h.fontCount = (uint32_t)m_chardatas.size();
+			h.reserved = 0;
+
+			std::vector<uint8_t> file(sizeof(h) + m_chardatas.size() * sizeof(chardatas) + (size_t)texwidth * texheight);
+			uint8_t *p = file.data();
+			memcpy(p, &h, sizeof(h));
+			p += sizeof(h);
+			memcpy(p, m_chardatas.data(), m_chardatas.size() * sizeof(chardatas));
+			p += m_chardatas.size() * sizeof(chardatas);
+			memcpy(p, bitmap, (size_t)texwidth * texheight);
+			file_write(cachefile, file.data(), file.size());
+		}
+
+		void upload(int texwidth, int texheight, const uint8_t *bitmap) {
+			// glyphs are sampled 1:1, mips would only cost memory
+			TextureDesc desc;
+			desc.mips = TextureDesc::Mips::None;
+			desc.wrap = TextureDesc::Wrap::Clamp;
+			// rebaking replaces the previous atlas
+			texture_release(m_tex);
+			m_tex = ursa::texture8bpp(texwidth, texheight, bitmap, desc);
+		}
+
 		ursa::TextureHandle m_tex;
 		std::vector<chardatas> m_chardatas;
-		std::vector<std::tuple<std::string, std::vector<float>>> m_sourcelist;
+		std::vector<GlyphMetrics> m_metrics;
+		std::map<std::string, pack::Span> m_fontfiles;
+		std::vector<FontSource> m_fonts;
+		std::vector<SdfFace> m_sdfFaces;
+		std::unordered_map<uint64_t, CachedGlyph> m_glyphs;
+		std::vector<GlyphPage> m_pages;
+		int m_pageSize = 512;
+		int m_maxPages = 4;
+		unsigned int m_epoch = 0;
+		struct SourceDesc {
+			std::string filename;
+			std::vector<float> sizes;
+			// 0 for plain bitmap glyphs
+			float sdfSize;
+		};
+		std::vector<SourceDesc> m_sourcelist;
 
 	};
 
@@ -303,52 +855,482 @@ void main()
 	FontAtlas::~FontAtlas() = default;
 	void FontAtlas::add_truetype(const char *filename, float font_size) { impl->add_truetype(filename, font_size); }
 	void FontAtlas::add_truetype(const char *filename, std::initializer_list<float> font_sizes) { impl->add_truetype(filename, font_sizes); }
-	void FontAtlas::bake(int texwidth, int texheight) { impl->bake(texwidth, texheight); }
-	ursa::TextureHandle FontAtlas::tex() const { return impl->tex(); }
+	void FontAtlas::add_truetype_sdf(const char *filename, std::initializer_list<float> font_sizes, float sdf_size) { impl->add_truetype_sdf(filename, font_sizes, sdf_size); }
+	void FontAtlas::bake(int texwidth, int texheight, const char *cachefile) { impl->bake(texwidth, texheight, cachefile); }
+	void FontAtlas::glyph_cache(int pageSize, int maxPages) { impl->glyph_cache(pageSize, maxPages); }
+	ursa::TextureHandle FontAtlas::tex(int page) const { return impl->tex(page); }
+	void FontAtlas::touch(int page) const { impl->touch(page); }
+	unsigned int FontAtlas::glyph_epoch() const { return impl->glyph_epoch(); }
 	FontAtlas::GlyphInfo FontAtlas::glyphInfo(int fontIndex, int codepoint) const { return impl->glyphInfo(fontIndex, codepoint); }
 	FontAtlas::FontInfo FontAtlas::fontInfo(int fontIndex) const { return impl->fontInfo(fontIndex);  }
+	float FontAtlas::kerning(int fontIndex, int first, int second) const { return impl->kerning(fontIndex, first, second); }
+	float FontAtlas::measure_run(int fontIndex, const char *text, size_t length) const { return impl->measure_run(fontIndex, text, length); }
 
 	ObjectRef<FontAtlas> font_atlas() { return FontAtlas::create_instance(); }
 
-	std::vector<FontAtlas> FontAtlas::s_instances;
-
 	// ...
 
-	TextureHandle internal_texture(int width, int height, const void *data, GLenum format) {
+	namespace internal {
+		// every texture created through the public functions gets a slot here, handles refer to it by slot and generation
+		struct TextureEntry {
+			TextureHandle tex;
+			uint32_t generation = 0;
+			int refs = 0;
+			size_t bytes = 0;
+			// only non-zero for block compressed textures
+			size_t uncompressedBytes = 0;
+			uint64_t lastUsed = 0;
+			bool resident = false;
+			// set for textures that can be recreated from their source after eviction
+			std::function<TextureHandle()> reload;
+			// key in g_loadedTextures for textures shared by file, removed along with the texture
+			std::string cacheKey;
+		};
+
+		static std::vector<TextureEntry> g_textures;
+		// shared handles for textures loaded from files, keyed by loader, normalized path and every parameter affecting the result
+		static std::unordered_map<std::string, TextureHandle> g_loadedTextures;
+		static std::vector<uint32_t> g_freeTextures;
+		static size_t g_textureBudget = 0;
+
+		const int textureSlotBits = 20;
+		const uint32_t textureSlotMask = (1u << textureSlotBits) - 1;
+
+		TextureEntry *find_texture(const TextureHandle &tex) {
+			if (!tex.id)
+				return nullptr;
+			uint32_t slot = (tex.id & textureSlotMask) - 1;
+			uint32_t generation = tex.id >> textureSlotBits;
+			if (slot >= g_textures.size() || g_textures[slot].generation != generation || !g_textures[slot].refs)
+				return nullptr;
+			return &g_textures[slot];
+		}
+
+		TextureHandle register_texture(TextureHandle tex, size_t bytes, size_t uncompressedBytes = 0) {
+			uint32_t slot;
+			if (!g_freeTextures.empty()) {
+				slot = g_freeTextures.back();
+				g_freeTextures.pop_back();
+			} else {
+				slot = (uint32_t)g_textures.size();
+				assert(slot < textureSlotMask);
+				g_textures.emplace_back();
+			}
+			TextureEntry &e = g_textures[slot];
+			tex.id = (e.generation << textureSlotBits) | (slot + 1);
+			e.tex = tex;
+			e.refs = 1;
+			e.bytes = bytes;
+			e.uncompressedBytes = uncompressedBytes;
+			e.lastUsed = g_frame;
+			e.resident = true;
+			e.reload = nullptr;
+			return tex;
+		}
+
+		void set_texture_kind(const TextureHandle &tex, TextureHandle::TextureKind kind) {
+			if (TextureEntry *e = find_texture(tex))
+				e->tex.kind = kind;
+		}
+
+		void set_reload(const TextureHandle &tex, std::function<TextureHandle()> reload) {
+			if (TextureEntry *e = find_texture(tex))
+				e->reload = std::move(reload);
+		}
+
+		void free_texture(TextureEntry &e) {
+			if (e.resident)
+				glDeleteTextures(1, &e.tex.handle);
+			// bumping the generation invalidates every copy of the handle still around
+			e.generation = (e.generation + 1) & (~0u >> textureSlotBits);
+			e.refs = 0;
+			e.resident = false;
+			e.reload = nullptr;
+			// the slot is reused with later generations, a key left behind could end up pointing at another texture
+			if (!e.cacheKey.empty()) {
+				g_loadedTextures.erase(e.cacheKey);
+				e.cacheKey.clear();
+			}
+			g_freeTextures.push_back((uint32_t)(&e - g_textures.data()));
+		}
+
+		// the handle as it is right now, reloading evicted textures on the spot
+		TextureHandle resolve_texture(const TextureHandle &tex) {
+			if (!tex.id)
+				return tex;
+			TextureEntry *e = find_texture(tex);
+			if (!e)
+				return { 0 };
+			if (!e->resident) {
+				uint32_t slot = (uint32_t)(e - g_textures.data());
+				// reloading registers a new entry, which can grow g_textures and destroy the function mid-call,
+				// so call a copy; reload closures, including the one async loads install, capture only by value
+				auto reload = e->reload;
+				TextureHandle fresh = reload();
+				// take over the new entry's GL texture and drop its slot
+				e = &g_textures[slot];
+				TextureEntry *loaded = find_texture(fresh);
+				if (!loaded)
+					return { 0 };
+				e->tex.handle = loaded->tex.handle;
+				e->tex.width = loaded->tex.width;
+				e->tex.height = loaded->tex.height;
+				e->bytes = loaded->bytes;
+				e->uncompressedBytes = loaded->uncompressedBytes;
+				e->resident = true;
+				loaded->resident = false;
+				free_texture(*loaded);
+			}
+			e->lastUsed = g_frame;
+			return e->tex;
+		}
+
+		// called once per frame after drawing, textures drawn in the current frame are never evicted
+		void evict_textures() {
+			g_frame++;
+			if (!g_textureBudget)
+				return;
+
+			size_t resident = 0;
+			std::vector<TextureEntry*> candidates;
+			for (auto &e : g_textures) {
+				if (!e.refs || !e.resident)
+					continue;
+				resident += e.bytes;
+				if (e.reload && e.lastUsed + 1 < g_frame)
+					candidates.push_back(&e);
+			}
+			if (resident <= g_textureBudget)
+				return;
+
+			std::sort(candidates.begin(), candidates.end(), [](const TextureEntry *a, const TextureEntry *b) {
+				return a->lastUsed < b->lastUsed;
+			});
+			for (TextureEntry *e : candidates) {
+				if (resident <= g_textureBudget)
+					break;
+				glDeleteTextures(1, &e->tex.handle);
+				e->tex.handle = 0;
+				e->resident = false;
+				resident -= e->bytes;
+			}
+		}
+	}
+
+	void texture_retain(TextureHandle tex) {
+		if (internal::TextureEntry *e = internal::find_texture(tex))
+			e->refs++;
+	}
+
+	void texture_release(TextureHandle tex) {
+		internal::TextureEntry *e = internal::find_texture(tex);
+		if (e && --e->refs == 0)
+			internal::free_texture(*e);
+	}
+
+	bool texture_valid(TextureHandle tex) {
+		return internal::find_texture(tex) != nullptr;
+	}
+
+	void texture_budget(size_t bytes) {
+		internal::g_textureBudget = bytes;
+	}
+
+	TextureMemoryStats texture_memory_stats() {
+		TextureMemoryStats stats = {};
+		stats.budgetBytes = internal::g_textureBudget;
+		for (const auto &e : internal::g_textures) {
+			if (!e.refs)
+				continue;
+			if (!e.resident) {
+				stats.evictedTextures++;
+				continue;
+			}
+			stats.residentTextures++;
+			stats.residentBytes += e.bytes;
+			if (e.uncompressedBytes) {
+				stats.compressedTextures++;
+				stats.uncompressedBytes += e.uncompressedBytes;
+				stats.compressedBytes += e.bytes;
+			}
+		}
+		return stats;
+	}
+
+	TextureRef::TextureRef(const TextureRef &other) : m_tex(other.m_tex) {
+		texture_retain(m_tex);
+	}
+
+	TextureRef::~TextureRef() {
+		texture_release(m_tex);
+	}
+
+	namespace internal {
+		bool has_texture_storage() {
+#ifdef GL_VERSION_4_2
+			if (GLAD_GL_VERSION_4_2) return true;
+#endif
+#ifdef GL_ARB_texture_storage
+			if (GLAD_GL_ARB_texture_storage) return true;
+#endif
+			return false;
+		}
+
+		// the entry point is only declared when glad was generated with 4.2 or ARB_texture_storage,
+		// callers check has_texture_storage() first
+		void tex_storage_2d(GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height) {
+#if defined(GL_VERSION_4_2) || defined(GL_ARB_texture_storage)
+			glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+#else
+			assert(!"immutable texture storage isn't available in this build");
+#endif
+		}
+
+		int mip_levels(int width, int height) {
+			int levels = 1;
+			while ((width | height) >> levels)
+				levels++;
+			return levels;
+		}
+
+		GLenum channels_format(int channels) {
+			switch (channels) {
+				case 1: return GL_RED;
+				case 2: return GL_RG;
+				case 3: return GL_RGB;
+				default: return GL_RGBA;
+			}
+		}
+
+		GLenum internal_format(const TextureDesc &desc, int channels) {
+			switch (desc.format) {
+				case TextureDesc::Format::RGBA8: return GL_RGBA8;
+				case TextureDesc::Format::RGB8: return GL_RGB8;
+				case TextureDesc::Format::R8: return GL_R8;
+				case TextureDesc::Format::SRGB8_ALPHA8: return GL_SRGB8_ALPHA8;
+				default: break;
+			}
+			switch (channels) {
+				case 1: return GL_R8;
+				case 2: return GL_RG8;
+				case 3: return GL_RGB8;
+				default: return GL_RGBA8;
+			}
+		}
+
+		// expects the texture to be bound
+		void apply_sampler(const TextureDesc &desc, int levels) {
+			bool nearest = (desc.filter == TextureDesc::Filter::Nearest);
+			GLint minFilter = nearest ? GL_NEAREST : GL_LINEAR;
+			if (levels > 1)
+				minFilter = nearest ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+			GLint wrap = GL_REPEAT;
+			if (desc.wrap == TextureDesc::Wrap::Clamp) wrap = GL_CLAMP_TO_EDGE;
+			if (desc.wrap == TextureDesc::Wrap::Mirror) wrap = GL_MIRRORED_REPEAT;
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, nearest ? GL_NEAREST : GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+			// keeps mutable textures complete and glGenerateMipmap from allocating levels we don't want
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		}
+
+		// box filtered mip chain, every level tightly packed after the previous one
+		std::vector<uint8_t> build_mip_chain(const uint8_t *pixels, int width, int height, int channels) {
+			size_t total = 0;
+			int levels = mip_levels(width, height);
+			for (int i = 0; i < levels; i++)
+				total += (size_t)std::max(1, width >> i) * std::max(1, height >> i) * channels;
+
+			std::vector<uint8_t> chain(total);
+			memcpy(chain.data(), pixels, (size_t)width * height * channels);
+
+			const uint8_t *src = chain.data();
+			uint8_t *dst = chain.data() + (size_t)width * height * channels;
+			int w = width, h = height;
+			for (int i = 1; i < levels; i++) {
+				int dw = std::max(1, w >> 1), dh = std::max(1, h >> 1);
+				for (int y = 0; y < dh; y++) {
+					int y0 = std::min(y * 2, h - 1), y1 = std::min(y * 2 + 1, h - 1);
+					for (int x = 0; x < dw; x++) {
+						int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+						for (int c = 0; c < channels; c++) {
+							int sum = src[(y0 * w + x0) * channels + c] + src[(y0 * w + x1) * channels + c]
+								+ src[(y1 * w + x0) * channels + c] + src[(y1 * w + x1) * channels + c];
+							dst[(y * dw + x) * channels + c] = (uint8_t)((sum + 2) / 4);
+						}
+					}
+				}
+				src = dst;
+				dst += (size_t)dw * dh * channels;
+				w = dw;
+				h = dh;
+			}
+			return chain;
+		}
+
+		bool has_s3tc() {
+#ifdef GL_EXT_texture_compression_s3tc
+			if (GLAD_GL_EXT_texture_compression_s3tc) return true;
+#endif
+			return false;
+		}
+
+		// only looks at the descriptor, so offline cache builds don't depend on the current driver
+		bool block_format(const TextureDesc &desc, int channels, bc::Format &format) {
+			switch (desc.compression) {
+				case TextureDesc::Compression::None: return false;
+				case TextureDesc::Compression::BC1: format = bc::Format::BC1; return true;
+				case TextureDesc::Compression::BC3: format = bc::Format::BC3; return true;
+				case TextureDesc::Compression::BC4: format = bc::Format::BC4; return true;
+				default: break;
+			}
+			format = (channels == 1) ? bc::Format::BC4 : (channels == 3) ? bc::Format::BC1 : bc::Format::BC3;
+			return true;
+		}
+
+		// RGTC is core since GL 3.0, S3TC still needs the extension
+		bool block_format_supported(bc::Format format) {
+			return (format == bc::Format::BC4) || has_s3tc();
+		}
+
+		GLenum block_gl_format(bc::Format format) {
+			switch (format) {
+				case bc::Format::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+				case bc::Format::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+				default: return GL_COMPRESSED_RED_RGTC1;
+			}
+		}
+
+		size_t chain_size(int width, int height, int channels, int levels) {
+			size_t total = 0;
+			for (int i = 0; i < levels; i++)
+				total += (size_t)std::max(1, width >> i) * std::max(1, height >> i) * channels;
+			return total;
+		}
+
+		size_t block_chain_size(bc::Format format, int width, int height, int levels) {
+			size_t total = 0;
+			for (int i = 0; i < levels; i++)
+				total += bc::compressed_size(format, std::max(1, width >> i), std::max(1, height >> i));
+			return total;
+		}
+
+		std::vector<uint8_t> compress_chain(const uint8_t *chain, int width, int height, int channels, int levels, bc::Format format, bc::Quality quality) {
+			std::vector<uint8_t> blocks(block_chain_size(format, width, height, levels));
+			uint8_t *dst = blocks.data();
+			for (int i = 0; i < levels; i++) {
+				int w = std::max(1, width >> i), h = std::max(1, height >> i);
+				bc::compress(chain, w, h, channels, format, quality, dst);
+				chain += (size_t)w * h * channels;
+				dst += bc::compressed_size(format, w, h);
+			}
+			return blocks;
+		}
+
+		TextureHandle upload_blocks(int width, int height, const uint8_t *blocks, int levels, bc::Format format, const TextureDesc &desc) {
+			GLenum glFormat = block_gl_format(format);
+
+			GLuint handle = 0;
+			glGenTextures(1, &handle);
+			glBindTexture(GL_TEXTURE_2D, handle);
+
+			bool immutable = desc.immutable && has_texture_storage();
+			if (immutable)
+				tex_storage_2d(levels, glFormat, width, height);
+			for (int i = 0; i < levels; i++) {
+				int w = std::max(1, width >> i), h = std::max(1, height >> i);
+				GLsizei size = (GLsizei)bc::compressed_size(format, w, h);
+				if (immutable)
+					glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, w, h, glFormat, size, blocks);
+				else
+					glCompressedTexImage2D(GL_TEXTURE_2D, i, glFormat, w, h, 0, size, blocks);
+				blocks += size;
+			}
+			apply_sampler(desc, levels);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			int channels = (format == bc::Format::BC4) ? 1 : (format == bc::Format::BC1) ? 3 : 4;
+			TextureHandle tex = { handle, width, height };
+			if (format == bc::Format::BC4)
+				tex.kind = TextureHandle::TextureKind::Alpha;
+			return register_texture(tex, block_chain_size(format, width, height, levels), chain_size(width, height, channels, levels));
+		}
+	}
+
+	// with Mips::Provided, data holds the full mip chain with each level tightly packed after the previous one
+	TextureHandle internal_texture(int width, int height, const void *data, int channels, const TextureDesc &desc) {
 		assert(data != nullptr);
 
 		internal::requires_window();
 
+		bc::Format blockFormat;
+		if (internal::block_format(desc, channels, blockFormat) && internal::block_format_supported(blockFormat)) {
+			// compressed formats can't rely on glGenerateMipmap, the chain is built on the CPU instead
+			int levels = (desc.mips == TextureDesc::Mips::None) ? 1 : internal::mip_levels(width, height);
+			const uint8_t *chain = static_cast<const uint8_t*>(data);
+			std::vector<uint8_t> generated;
+			if (desc.mips == TextureDesc::Mips::Generate) {
+				generated = internal::build_mip_chain(chain, width, height, channels);
+				chain = generated.data();
+			}
+			bc::Quality quality = (desc.compressionQuality == TextureDesc::CompressionQuality::High) ? bc::Quality::High : bc::Quality::Fast;
+			auto blocks = internal::compress_chain(chain, width, height, channels, levels, blockFormat, quality);
+			return internal::upload_blocks(width, height, blocks.data(), levels, blockFormat, desc);
+		}
+
+		GLenum format = internal::channels_format(channels);
+		GLenum internalFormat = internal::internal_format(desc, channels);
+		int levels = (desc.mips == TextureDesc::Mips::None) ? 1 : internal::mip_levels(width, height);
+		bool immutable = desc.immutable && internal::has_texture_storage();
+
 		GLuint handle = 0;
 		glGenTextures(1, &handle);
-		// TODO set min/mag filter or some other tex parameters?
-
 		glBindTexture(GL_TEXTURE_2D, handle);
-		glTexImage2D(GL_TEXTURE_2D, 0 /*miplevel*/, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		if (immutable)
+			internal::tex_storage_2d(levels, internalFormat, width, height);
+
+		int uploadLevels = (desc.mips == TextureDesc::Mips::Provided) ? levels : 1;
+		const uint8_t *level = static_cast<const uint8_t*>(data);
+		for (int i = 0; i < uploadLevels; i++) {
+			int w = std::max(1, width >> i), h = std::max(1, height >> i);
+			if (immutable)
+				glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, w, h, format, GL_UNSIGNED_BYTE, level);
+			else
+				glTexImage2D(GL_TEXTURE_2D, i, internalFormat, w, h, 0, format, GL_UNSIGNED_BYTE, level);
+			level += (size_t)w * h * channels;
+		}
+
+		internal::apply_sampler(desc, levels);
+		if (desc.mips == TextureDesc::Mips::Generate)
+			glGenerateMipmap(GL_TEXTURE_2D);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glBindTexture(GL_TEXTURE_2D, 0);
 
-		return { handle, width, height };
+		TextureHandle tex = { handle, width, height };
+		if (channels == 1)
+			tex.kind = TextureHandle::TextureKind::Alpha;
+		return internal::register_texture(tex, internal::chain_size(width, height, channels, levels));
 	}
 
-	TextureHandle texture(int width, int height, const void *data) {
-		return internal_texture(width, height, data, GL_RGBA);
+	TextureHandle texture(int width, int height, const void *data, const TextureDesc &desc) {
+		return internal_texture(width, height, data, 4, desc);
 	}
 
-	TextureHandle texture8bpp(int width, int height, const void *data) {
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		auto tex = internal_texture(width, height, data, GL_RED);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-		tex.kind = TextureHandle::TextureKind::Alpha;
-		return tex;
+	TextureHandle texture8bpp(int width, int height, const void *data, const TextureDesc &desc) {
+		return internal_texture(width, height, data, 1, desc);
 	}
 
-	TextureHandle texture(const char *filename) {
+	TextureHandle load_texture_file(const char *filename, const TextureDesc &desc) {
 		// load file
-		// TODO SDL_GetBasePath() + name? need a resource management scheme
+		// TODO SDL_GetBasePath() + name?
 		int width = 0, height = 0, channels = 0;
-		uint8_t *pixels = stbi_load(filename, &width, &height, &channels, 0 /*STBI_rgb_alpha*/);
+		pack::Span file = pack::load(filename);
+		uint8_t *pixels = file.valid() ? stbi_load_from_memory(file.data, (int)file.size, &width, &height, &channels, 0 /*STBI_rgb_alpha*/) : nullptr;
 		if (!pixels) {
 			// TODO error handling
 			abort();
@@ -356,10 +1338,515 @@ void main()
 		}
 
 		assert((channels == 3) || (channels==4));
-		GLenum format = (channels == 3) ? GL_RGB : GL_RGBA;
-		TextureHandle handle = internal_texture(width, height, pixels, format);
+		// a decoded image never carries a mip chain
+		TextureDesc generated = desc;
+		if (generated.mips == TextureDesc::Mips::Provided)
+			generated.mips = TextureDesc::Mips::Generate;
+		TextureHandle handle = internal_texture(width, height, pixels, channels, generated);
+		stbi_image_free(pixels);
+
+		std::string path = filename;
+		internal::set_reload(handle, [path, desc]() { return load_texture_file(path.c_str(), desc); });
+		return handle;
+	}
+
+	namespace internal {
+		static int g_textureHits = 0;
+		static int g_textureMisses = 0;
+
+		std::string texture_key(const char *loader, const char *filename, const TextureDesc &desc, const char *extra = nullptr) {
+			char params[64];
+			snprintf(params, sizeof(params), "|%d%d%d%d%d%d%d|", (int)desc.mips, (int)desc.filter, (int)desc.wrap, (int)desc.format,
+				(int)desc.immutable, (int)desc.compression, (int)desc.compressionQuality);
+			std::string key = loader;
+			key += params;
+			key += normalize_path(filename);
+			if (extra) {
+				key += '|';
+				key += normalize_path(extra);
+			}
+			return key;
+		}
+
+		// every caller gets its own reference to the shared texture
+		TextureHandle shared_texture(const std::string &key, const std::function<TextureHandle()> &load) {
+			auto it = g_loadedTextures.find(key);
+			if (it != g_loadedTextures.end() && texture_valid(it->second)) {
+				g_textureHits++;
+				texture_retain(it->second);
+				return it->second;
+			}
+			g_textureMisses++;
+			TextureHandle handle = load();
+			if (TextureEntry *e = find_texture(handle)) {
+				g_loadedTextures[key] = handle;
+				e->cacheKey = key;
+			}
+			else {
+				g_loadedTextures.erase(key);
+			}
+			return handle;
+		}
+	}
+
+	TextureHandle texture(const char *filename, const TextureDesc &desc) {
+		return internal::shared_texture(internal::texture_key("image", filename, desc), [&]() { return load_texture_file(filename, desc); });
+	}
+
+	ResourceCacheStats resource_cache_stats() {
+		// released textures take their entries with them, the map only holds live textures
+		FileCacheStats files = file_cache_stats();
+		ResourceCacheStats stats;
+		stats.textureHits = internal::g_textureHits;
+		stats.textureMisses = internal::g_textureMisses;
+		stats.sharedTextures = (int)internal::g_loadedTextures.size();
+		stats.fileHits = files.hits;
+		stats.fileMisses = files.misses;
+		stats.mappedFiles = files.mapped;
+		return stats;
+	}
+
+	namespace internal {
+		// texture cache file: header followed by the mip chain, optionally lz compressed
+		struct TextureCacheHeader {
+			char magic[4];
+			uint32_t version;
+			uint32_t width, height, channels;
+			uint32_t flags;
+			// 0 for plain pixels, otherwise bc::Format + 1
+			uint32_t blockFormat;
+			uint32_t reserved;
+			uint64_t payloadSize;
+			uint64_t pixelSize;
+			uint64_t sourceSize, sourceMtime, sourceHash;
+		};
+
+		const char textureCacheMagic[4] = { 'U', 'T', 'C', '1' };
+		const uint32_t textureCacheVersion = 2;
+		const uint32_t textureCacheCompressed = 1;
+
+		std::string texture_cache_path(const char *filename, const char *cachefile) {
+			return cachefile ? std::string(cachefile) : std::string(filename) + ".utc";
+		}
+
+		bool texture_cache_header_ok(const MappedFile &cache) {
+			if (cache.size() < sizeof(TextureCacheHeader))
+				return false;
+			const auto &h = *reinterpret_cast<const TextureCacheHeader*>(cache.data());
+			if (memcmp(h.magic, textureCacheMagic, 4) != 0 || h.version != textureCacheVersion)
+				return false;
+			if (h.payloadSize > cache.size() - sizeof(TextureCacheHeader))
+				return false;
+			if (h.blockFormat > (uint32_t)bc::Format::BC4 + 1)
+				return false;
+			int levels = mip_levels(h.width, h.height);
+			size_t expected = h.blockFormat
+				? block_chain_size((bc::Format)(h.blockFormat - 1), h.width, h.height, levels)
+				: chain_size(h.width, h.height, h.channels, levels);
+			return h.pixelSize == expected;
+		}
+
+		enum class CacheState { Valid, Stale, Touch };
+
+		// size and timestamp are checked first, the source is only hashed when those disagree
+		CacheState texture_cache_state(const TextureCacheHeader &h, const char *filename) {
+			FileStat st = file_stat(filename);
+			if (!st.exists)
+				return CacheState::Valid; // shipped without sources
+			if (st.size != h.sourceSize)
+				return CacheState::Stale;
+			if (st.mtime == h.sourceMtime)
+				return CacheState::Valid;
+			MappedFile source(filename);
+			if (source.valid() && hash_bytes(source.data(), source.size()) == h.sourceHash)
+				return CacheState::Touch;
+			return CacheState::Stale;
+		}
+	}
+
+	bool texture_cache_build(const char *filename, const char *cachefile, bool compress, const TextureDesc &desc) {
+		MappedFile source(filename);
+		if (!source.valid())
+			return false;
+
+		int width = 0, height = 0, channels = 0;
+		uint8_t *pixels = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channels, 0);
+		if (pixels && channels < 3) {
+			// same formats as texture(filename)
+			stbi_image_free(pixels);
+			pixels = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channels, 4);
+			channels = 4;
+		}
+		if (!pixels)
+			return false;
+
+		std::vector<uint8_t> chain = internal::build_mip_chain(pixels, width, height, channels);
 		stbi_image_free(pixels);
 
+		uint32_t blockFormat = 0;
+		bc::Format format;
+		if (internal::block_format(desc, channels, format)) {
+			bc::Quality quality = (desc.compressionQuality == TextureDesc::CompressionQuality::High) ? bc::Quality::High : bc::Quality::Fast;
+			chain = internal::compress_chain(chain.data(), width, height, channels, internal::mip_levels(width, height), format, quality);
+			blockFormat = (uint32_t)format + 1;
+		}
+
+		FileStat st = file_stat(filename);
+		internal::TextureCacheHeader h;
+		memcpy(h.magic, internal::textureCacheMagic, 4);
+		h.version = internal::textureCacheVersion;
+		h.width = width;
+		h.height = height;
+		h.channels = channels;
+		h.flags = 0;
+		h.blockFormat = blockFormat;
+		h.reserved = 0;
+		h.pixelSize = chain.size();
+		h.sourceSize = st.size;
+		h.sourceMtime = st.mtime;
+		h.sourceHash = hash_bytes(source.data(), source.size());
+
+		std::vector<uint8_t> packed;
+		if (compress) {
+			packed = lz::compress(chain.data(), chain.size());
+			// not worth it for noisy images
+			if (packed.size() < chain.size())
+				h.flags |= internal::textureCacheCompressed;
+		}
+		const std::vector<uint8_t> &payload = (h.flags & internal::textureCacheCompressed) ? packed : chain;
+		h.payloadSize = payload.size();
+
+		std::vector<uint8_t> file(sizeof(h) + payload.size());
+		memcpy(file.data(), &h, sizeof(h));
+		memcpy(file.data() + sizeof(h), payload.data(), payload.size());
+		return file_write(internal::texture_cache_path(filename, cachefile).c_str(), file.data(), file.size());
+	}
+
+	TextureHandle load_texture_cached(const char *filename, const TextureDesc &desc, const char *cachefile) {
+		std::string path = internal::texture_cache_path(filename, cachefile);
+
+		internal::CacheState state = internal::CacheState::Stale;
+		MappedFile cache(path.c_str());
+		if (internal::texture_cache_header_ok(cache)) {
+			const auto &h = *reinterpret_cast<const internal::TextureCacheHeader*>(cache.data());
+			// a cache built with a different compression setting is as good as missing
+			bc::Format wanted;
+			uint32_t blockFormat = internal::block_format(desc, h.channels, wanted) ? (uint32_t)wanted + 1 : 0;
+			if (h.blockFormat == blockFormat)
+				state = internal::texture_cache_state(h, filename);
+		}
+
+		if (state == internal::CacheState::Stale) {
+			// release the old mapping before overwriting the file
+			cache = MappedFile();
+			if (!texture_cache_build(filename, path.c_str(), false, desc))
+				return load_texture_file(filename, desc);
+			cache = MappedFile(path.c_str());
+			if (!internal::texture_cache_header_ok(cache))
+				return load_texture_file(filename, desc);
+		}
+
+		internal::TextureCacheHeader h = *reinterpret_cast<const internal::TextureCacheHeader*>(cache.data());
+		const uint8_t *pixels = cache.data() + sizeof(h);
+		std::vector<uint8_t> unpacked;
+		if (h.flags & internal::textureCacheCompressed) {
+			unpacked.resize(h.pixelSize);
+			if (!lz::decompress(pixels, h.payloadSize, unpacked.data(), unpacked.size()))
+				return load_texture_file(filename, desc);
+			pixels = unpacked.data();
+		} else if (h.payloadSize != h.pixelSize) {
+			return load_texture_file(filename, desc);
+		}
+
+		// the cache always holds the full chain, level 0 comes first so it also works without mips
+		int levels = (desc.mips == TextureDesc::Mips::None) ? 1 : internal::mip_levels(h.width, h.height);
+		TextureHandle handle;
+		if (h.blockFormat) {
+			bc::Format format = (bc::Format)(h.blockFormat - 1);
+			if (!internal::block_format_supported(format)) {
+				TextureDesc plain = desc;
+				plain.compression = TextureDesc::Compression::None;
+				return load_texture_file(filename, plain);
+			}
+			internal::requires_window();
+			handle = internal::upload_blocks(h.width, h.height, pixels, levels, format, desc);
+		} else {
+			TextureDesc chainDesc = desc;
+			chainDesc.compression = TextureDesc::Compression::None;
+			if (chainDesc.mips != TextureDesc::Mips::None)
+				chainDesc.mips = TextureDesc::Mips::Provided;
+			handle = internal_texture(h.width, h.height, pixels, h.channels, chainDesc);
+		}
+
+		if (state == internal::CacheState::Touch) {
+			// source was touched but not changed, remember the new timestamp to skip hashing next time
+			cache = MappedFile();
+			h.sourceMtime = file_stat(filename).mtime;
+			std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+			file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		}
+
+		std::string source = filename, cacheName = path;
+		internal::set_reload(handle, [source, desc, cacheName]() { return load_texture_cached(source.c_str(), desc, cacheName.c_str()); });
+		return handle;
+	}
+
+	TextureHandle texture_cached(const char *filename, const TextureDesc &desc, const char *cachefile) {
+		std::string path = internal::texture_cache_path(filename, cachefile);
+		return internal::shared_texture(internal::texture_key("cached", filename, desc, path.c_str()), [&]() { return load_texture_cached(filename, desc, cachefile); });
+	}
+
+	namespace internal {
+		struct UploadJob {
+			int priority;
+			uint64_t sequence;
+			// uploads at most the given amount of bytes (but always makes some progress), returns true when finished
+			std::function<bool(size_t &bytes)> step;
+		};
+
+		struct DecodedTexture {
+			TextureHandle handle;
+			uint8_t *pixels;
+			int width, height, channels;
+			UploadPriority priority;
+			std::function<void(TextureHandle)> on_ready;
+			std::string path;
+		};
+
+		static std::mutex g_decodedMutex;
+		static std::vector<DecodedTexture> g_decoded;
+
+		static std::vector<UploadJob> g_uploads;
+		static uint64_t g_uploadSequence = 0;
+		static float g_uploadBudgetMs = 2.0f;
+		static size_t g_uploadBudgetBytes = 4 * 1024 * 1024;
+
+		void enqueue_upload(int priority, std::function<bool(size_t &bytes)> step) {
+			g_uploads.push_back({ priority, g_uploadSequence++, std::move(step) });
+		}
+
+		// ring of pixel buffer objects for streaming texture data, each slot is fenced after use so
+		// the CPU can refill a buffer only once the GPU is done with it, and orphans it otherwise
+		struct PixelBufferRing {
+			static const int slots = 3;
+			GLuint pbo[slots] = { 0 };
+			GLsync fence[slots] = { nullptr };
+			size_t capacity[slots] = { 0 };
+			int next = 0;
+
+			// returns the slot, bound to GL_PIXEL_UNPACK_BUFFER and filled with data,
+			// or -1 with nothing bound when the buffer could not be mapped
+			int stage(const void *data, size_t bytes) {
+				int i = next;
+				next = (next + 1) % slots;
+
+				if (!pbo[i])
+					glGenBuffers(1, &pbo[i]);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+
+				bool idle = true;
+				if (fence[i]) {
+					idle = glClientWaitSync(fence[i], 0, 0) != GL_TIMEOUT_EXPIRED;
+					glDeleteSync(fence[i]);
+					fence[i] = nullptr;
+				}
+
+				GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+				if (bytes > capacity[i] || !idle) {
+					// fresh storage instead of stalling on a transfer still in flight
+					capacity[i] = std::max(bytes, capacity[i]);
+					glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity[i], nullptr, GL_STREAM_DRAW);
+				} else {
+					access |= GL_MAP_UNSYNCHRONIZED_BIT;
+				}
+				void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, access);
+				if (!dst) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					return -1;
+				}
+				memcpy(dst, data, bytes);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				return i;
+			}
+
+			// call after the commands reading the slot have been issued
+			void release(int i) {
+				fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		};
+
+		static PixelBufferRing g_pixelBuffers;
+
+		void upload_subimage(GLuint tex, int x, int y, int width, int rows, GLenum format, const void *data, size_t bytes) {
+			int slot = g_pixelBuffers.stage(data, bytes);
+			// without a mapped buffer the driver copies straight from client memory
+			const void *source = (slot >= 0) ? (const void*)0 /*PBO offset*/ : data;
+
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexSubImage2D(GL_TEXTURE_2D, 0 /*miplevel*/, x, y, width, rows, format, GL_UNSIGNED_BYTE, source);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			if (slot >= 0)
+				g_pixelBuffers.release(slot);
+		}
+
+		// large images are streamed in bands of rows, the mip chain is generated after the last band
+		void enqueue_texture_upload(DecodedTexture t) {
+			auto shared = std::make_shared<DecodedTexture>(std::move(t));
+			auto row = std::make_shared<int>(-1);
+			enqueue_upload((int)shared->priority, [shared, row](size_t &bytes) {
+				DecodedTexture &t = *shared;
+				GLenum format = (t.channels == 3) ? GL_RGB : GL_RGBA;
+				size_t rowBytes = (size_t)t.width * t.channels;
+
+				// released while still loading
+				TextureEntry *entry = find_texture(t.handle);
+				if (!entry) {
+					stbi_image_free(t.pixels);
+					t.pixels = nullptr;
+					return true;
+				}
+
+				if (*row < 0) {
+					// allocate the full size storage first, the placeholder goes away here
+					glBindTexture(GL_TEXTURE_2D, t.handle.handle);
+					glTexImage2D(GL_TEXTURE_2D, 0 /*miplevel*/, format, t.width, t.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+					glBindTexture(GL_TEXTURE_2D, 0);
+					*row = 0;
+				}
+
+				int rows = std::max(1, std::min(t.height - *row, (int)(bytes / rowBytes)));
+				size_t chunk = rows * rowBytes;
+				upload_subimage(t.handle.handle, 0, *row, t.width, rows, format, t.pixels + *row * rowBytes, chunk);
+				*row += rows;
+				bytes -= std::min(bytes, chunk);
+
+				if (*row < t.height)
+					return false;
+
+				glBindTexture(GL_TEXTURE_2D, t.handle.handle);
+				internal::apply_sampler(TextureDesc(), internal::mip_levels(t.width, t.height));
+				glGenerateMipmap(GL_TEXTURE_2D);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				stbi_image_free(t.pixels);
+				t.pixels = nullptr;
+
+				entry->tex.width = t.width;
+				entry->tex.height = t.height;
+				entry->bytes = chain_size(t.width, t.height, t.channels, mip_levels(t.width, t.height));
+				std::string path = t.path;
+				entry->reload = [path]() { return load_texture_file(path.c_str(), TextureDesc()); };
+				if (t.on_ready)
+					t.on_ready(entry->tex);
+				return true;
+			});
+		}
+
+		// called once per frame on the render thread
+		void process_uploads() {
+			std::vector<DecodedTexture> decoded;
+			{
+				std::lock_guard<std::mutex> lock(g_decodedMutex);
+				decoded.swap(g_decoded);
+			}
+			for (auto &t : decoded) {
+				if (t.pixels) {
+					enqueue_texture_upload(std::move(t));
+				} else if (t.on_ready) {
+					t.on_ready({ 0 });
+				}
+			}
+
+			if (g_uploads.empty())
+				return;
+
+			// steps run user code that may enqueue more uploads, which must not move the job that is running
+			std::vector<UploadJob> jobs;
+			jobs.swap(g_uploads);
+
+			// highest priority first, oldest first within the same priority
+			std::sort(jobs.begin(), jobs.end(), [](const UploadJob &a, const UploadJob &b) {
+				return (a.priority != b.priority) ? (a.priority > b.priority) : (a.sequence < b.sequence);
+			});
+
+			const uint64_t start = SDL_GetPerformanceCounter();
+			const uint64_t deadline = start + (uint64_t)(g_uploadBudgetMs * 0.001 * SDL_GetPerformanceFrequency());
+			size_t bytes = g_uploadBudgetBytes;
+
+			size_t finished = 0;
+			while (finished < jobs.size()) {
+				if (jobs[finished].step(bytes))
+					finished++;
+				if (bytes == 0 || SDL_GetPerformanceCounter() >= deadline)
+					break;
+			}
+			// the next frame sorts the leftovers back in with whatever was enqueued meanwhile
+			for (size_t i = finished; i < jobs.size(); i++)
+				g_uploads.push_back(std::move(jobs[i]));
+		}
+	}
+
+	void upload_budget(float milliseconds, size_t bytes) {
+		internal::g_uploadBudgetMs = milliseconds;
+		internal::g_uploadBudgetBytes = bytes;
+	}
+
+	void upload_enqueue(size_t bytes, std::function<void()> upload, UploadPriority priority) {
+		internal::enqueue_upload((int)priority, [bytes, upload](size_t &budget) {
+			upload();
+			budget -= std::min(budget, bytes);
+			return true;
+		});
+	}
+
+	void texture_update(TextureHandle tex, Rect subrect, const void *pixels, bool regenerate_mips) {
+		assert(pixels != nullptr);
+		tex = internal::resolve_texture(tex);
+		if (!tex.handle)
+			return;
+		int x = (int)subrect.pos.x, y = (int)subrect.pos.y;
+		int width = (int)subrect.size.x, height = (int)subrect.size.y;
+		assert(x >= 0 && y >= 0 && x + width <= tex.width && y + height <= tex.height);
+		if (width <= 0 || height <= 0)
+			return;
+
+		bool alpha = (tex.kind == TextureHandle::TextureKind::Alpha);
+		size_t bytes = (size_t)width * height * (alpha ? 1 : 4);
+		internal::upload_subimage(tex.handle, x, y, width, height, alpha ? GL_RED : GL_RGBA, pixels, bytes);
+
+		if (regenerate_mips) {
+			glBindTexture(GL_TEXTURE_2D, tex.handle);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+
+	TextureHandle texture_async(const char *filename, std::function<void(TextureHandle)> on_ready, UploadPriority priority) {
+		// transparent 1x1 placeholder, the GL name stays the same once the real image arrives
+		// so the storage has to stay mutable
+		const uint32_t placeholder = 0;
+		TextureDesc desc;
+		desc.immutable = false;
+		TextureHandle handle = texture(1, 1, &placeholder, desc);
+
+		std::string path = filename;
+		jobs::submit([handle, path, priority, on_ready]() {
+			internal::DecodedTexture t{ handle, nullptr, 0, 0, 0, priority, on_ready, path };
+			pack::Span file = pack::load(path.c_str());
+			if (file.valid())
+				t.pixels = stbi_load_from_memory(file.data, (int)file.size, &t.width, &t.height, &t.channels, 0);
+			if (t.pixels && (t.channels != 3) && (t.channels != 4)) {
+				// TODO support grey and grey+alpha images
+				stbi_image_free(t.pixels);
+				t.pixels = nullptr;
+			}
+			std::lock_guard<std::mutex> lock(internal::g_decodedMutex);
+			internal::g_decoded.push_back(std::move(t));
+		});
+
 		return handle;
 	}
 
@@ -438,21 +1925,82 @@ void main()
 		draw_triangles(vertices, 6);
 	}
 
+	namespace internal {
+		// tex must already be resolved
+		void bind_texture(const TextureHandle &tex) {
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, tex.handle);
+			GLint texloc = glGetUniformLocation(internal::g_shader, "tex");
+			GLint usetexloc = glGetUniformLocation(internal::g_shader, "use_tex");
+			GLint alphatexloc = glGetUniformLocation(internal::g_shader, "alpha_tex");
+			GLint distancetexloc = glGetUniformLocation(internal::g_shader, "distance_tex");
+			glUniform1i(texloc, 0 /*texture unit*/);
+			glUniform1i(usetexloc, GL_TRUE);
+			glUniform1i(alphatexloc, (tex.kind == TextureHandle::TextureKind::Alpha) ? GL_TRUE : GL_FALSE);
+			glUniform1i(distancetexloc, (tex.kind == TextureHandle::TextureKind::Distance) ? GL_TRUE : GL_FALSE);
+		}
+
+		void unbind_texture() {
+			glUniform1i(glGetUniformLocation(internal::g_shader, "use_tex"), GL_FALSE);
+			glUniform1i(glGetUniformLocation(internal::g_shader, "alpha_tex"), GL_FALSE);
+			glUniform1i(glGetUniformLocation(internal::g_shader, "distance_tex"), GL_FALSE);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+
+	void draw_indexed(const Vertex vertices[], int vertexCount, const uint32_t indices[], int indexCount, const DrawCommand commands[], int commandCount) {
+		if (!indexCount)
+			return;
+		glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex)*vertexCount, vertices, GL_DYNAMIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t)*indexCount, indices, GL_DYNAMIC_DRAW);
+
+		bool scissor = false;
+		Rect screen = screenrect();
+		for (int i = 0; i < commandCount; i++) {
+			const DrawCommand &cmd = commands[i];
+			if (!cmd.indexCount)
+				continue;
+			TextureHandle tex = { 0 };
+			if (cmd.texture.handle || cmd.texture.id) {
+				tex = internal::resolve_texture(cmd.texture);
+				// evicted and failed to reload, skip rather than draw the untextured fallback
+				if (!tex.handle)
+					continue;
+			}
+
+			bool clipped = cmd.clip.size.x > 0.0f || cmd.clip.size.y > 0.0f;
+			if (clipped != scissor) {
+				clipped ? glEnable(GL_SCISSOR_TEST) : glDisable(GL_SCISSOR_TEST);
+				scissor = clipped;
+			}
+			if (clipped) {
+				// scissor boxes count from the bottom left
+				glScissor((GLint)floor(cmd.clip.left()), (GLint)floor(screen.size.y - cmd.clip.bottom()),
+					(GLsizei)ceil(cmd.clip.size.x), (GLsizei)ceil(cmd.clip.size.y));
+			}
+
+			if (tex.handle)
+				internal::bind_texture(tex);
+			glDrawElements(GL_TRIANGLES, cmd.indexCount, GL_UNSIGNED_INT, (void*)(sizeof(uint32_t)*cmd.firstIndex));
+			if (tex.handle)
+				internal::unbind_texture();
+		}
+		if (scissor)
+			glDisable(GL_SCISSOR_TEST);
+	}
+
 	void draw_rect(TextureHandle tex, Rect rect, Rect crop, glm::vec4 color)
 	{
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, tex.handle);
-		GLint texloc = glGetUniformLocation(internal::g_shader, "tex");
-		GLint usetexloc = glGetUniformLocation(internal::g_shader, "use_tex");
-		GLint alphatexloc = glGetUniformLocation(internal::g_shader, "alpha_tex");
-		glUniform1i(texloc, 0 /*texture unit*/);
-		glUniform1i(usetexloc, GL_TRUE);
-		glUniform1i(alphatexloc, (tex.kind == TextureHandle::TextureKind::Alpha) ? GL_TRUE : GL_FALSE);
+		tex = internal::resolve_texture(tex);
+		if (!tex.handle)
+			return;
+
+		internal::bind_texture(tex);
 		Rect uv = { crop.pos / tex.size(), crop.size / tex.size() };
 		internal_draw_rect(rect, uv, color);
-		glUniform1i(usetexloc, GL_FALSE);
-		glUniform1i(alphatexloc, GL_FALSE);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		internal::unbind_texture();
 	}
 
 	void draw_rect(Rect r, glm::vec4 color) {
@@ -460,6 +2008,8 @@ void main()
 	}
 
 	void draw_rect(TextureHandle tex, Rect rect, glm::vec4 color) {
+		// the size might have changed since the handle was copied, e.g. after an async load
+		tex = internal::resolve_texture(tex);
 		draw_rect(tex, rect, tex.bounds(), color);
 	}
 
@@ -481,6 +2031,7 @@ void main()
 
 	void draw_9patch(TextureHandle tex, Rect rect, int margin, glm::vec4 color) {
 		glm::vec2 border((float)margin);
+		tex = internal::resolve_texture(tex);
 		Rect crop = tex.bounds();
 
 		// ninepatch widths ands offsets for output rect
@@ -501,43 +2052,402 @@ void main()
 	}
 
 	void draw_text(FontAtlas::object_ref fonts, int fontIndex, float x, float y, const char *text, glm::vec4 color)
+	{
+		draw_text(fonts, fontIndex, x, y, text, strlen(text), color);
+	}
+
+	void draw_text(FontAtlas::object_ref fonts, int fontIndex, float x, float y, const char *text, size_t length, glm::vec4 color)
 	{
 		const auto &fontInfo = fonts->fontInfo(fontIndex);
 		y += fontInfo.ascent;
 
-		std::vector<Rect> rects;
-		std::vector<Rect> crops;
-		std::vector<glm::vec4> colors;
+		// glyphs are gathered into a fixed batch on the stack, nothing is allocated per call
+		const int batchSize = 64;
+		Rect rects[batchSize];
+		Rect crops[batchSize];
+		glm::vec4 colors[batchSize];
+		int count = 0;
+		int page = 0;
+
+		auto flush = [&]() {
+			if (count)
+				draw_rects(fonts->tex(page), rects, crops, colors, count);
+			count = 0;
+		};
 
-		for (const char *p = text; *p; p++) {
-			auto info = fonts->glyphInfo(fontIndex, *p);
-			rects.push_back(info.bounds.offset(x, y));
-			crops.push_back(info.crop);
-			colors.push_back(color);
+		int prev = -1;
+		utf8::for_each(text, length, [&](uint32_t codepoint) {
+			if (prev >= 0)
+				x += fonts->kerning(fontIndex, prev, (int)codepoint);
+			prev = (int)codepoint;
+			auto info = fonts->glyphInfo(fontIndex, (int)codepoint);
+			// glyphs come from several atlas pages, draw a batch whenever the page changes
+			if (info.page != page || count == batchSize) {
+				flush();
+				page = info.page;
+			}
+			rects[count] = info.bounds.offset(x, y);
+			crops[count] = info.crop;
+			colors[count] = color;
+			count++;
 			x += info.xadvance;
+		});
+		flush();
+	}
+
+	glm::vec2 measure_text(FontAtlas::object_ref fonts, int fontIndex, const char *text) {
+		const auto &fontInfo = fonts->fontInfo(fontIndex);
+		return { fonts->measure_run(fontIndex, text, strlen(text)), fontInfo.ascent - fontInfo.descent };
+	}
+
+	class TextImpl {
+	public:
+		~TextImpl() {
+			if (m_vbo)
+				glDeleteBuffers(1, &m_vbo);
+			if (m_vao)
+				glDeleteVertexArrays(1, &m_vao);
+		}
+
+		void set_text(const char *text) {
+			if (m_text != text) {
+				m_text = text;
+				m_dirty = true;
+			}
+		}
+
+		void set_font(FontAtlas::object_ref fonts, int fontIndex) {
+			if (!m_hasFont || fonts != m_fonts || fontIndex != m_fontIndex) {
+				m_fonts = fonts;
+				m_fontIndex = fontIndex;
+				m_hasFont = true;
+				m_dirty = true;
+			}
+		}
+
+		void set_color(glm::vec4 color) {
+			if (color != m_color) {
+				m_color = color;
+				m_dirty = true;
+			}
 		}
 
-		draw_rects(fonts->tex(), rects.data(), crops.data(), colors.data(), rects.size());
+		glm::vec2 size() {
+			update();
+			return m_size;
+		}
+
+		void draw(glm::vec3 offset) {
+			update();
+			if (m_batches.empty())
+				return;
+
+			GLint offsetloc = glGetUniformLocation(internal::g_shader, "offset");
+			glUniform3f(offsetloc, offset.x, offset.y, offset.z);
+			glBindVertexArray(m_vao);
+			for (const auto &batch : m_batches) {
+				// the glyphs aren't asked for again, so keep their page from looking cold to the eviction
+				m_fonts->touch(batch.page);
+				TextureHandle tex = internal::resolve_texture(m_fonts->tex(batch.page));
+				if (!tex.handle)
+					continue;
+				internal::bind_texture(tex);
+				glDrawArrays(GL_TRIANGLES, batch.first, batch.count);
+			}
+			internal::unbind_texture();
+			glUniform3f(offsetloc, 0.0f, 0.0f, 0.0f);
+
+			// immediate drawing expects the shared buffers
+			glBindVertexArray(internal::g_VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, internal::g_VBO);
+		}
+
+	private:
+		struct Batch {
+			int page;
+			int first, count;
+		};
+
+		// glyphs are rebuilt when something changed or the atlas moved glyphs around since the last layout
+		void update() {
+			if (!m_hasFont || (!m_dirty && m_epoch == m_fonts->glyph_epoch()))
+				return;
+			m_dirty = false;
+
+			struct Quad {
+				int page;
+				Rect rect, crop;
+			};
+			std::vector<Quad> quads;
+			quads.reserve(m_text.size());
+
+			const auto &fontInfo = m_fonts->fontInfo(m_fontIndex);
+			float x = 0.0f, y = fontInfo.ascent;
+			int prev = -1;
+			utf8::for_each(m_text.data(), m_text.size(), [&](uint32_t codepoint) {
+				if (prev >= 0)
+					x += m_fonts->kerning(m_fontIndex, prev, (int)codepoint);
+				prev = (int)codepoint;
+				auto info = m_fonts->glyphInfo(m_fontIndex, (int)codepoint);
+				// nothing else would make the text ask for the glyph again, so stay dirty until it is placed
+				if (info.pending)
+					m_dirty = true;
+				if (info.bounds.size.x > 0.0f && info.bounds.size.y > 0.0f)
+					quads.push_back({ info.page, info.bounds.offset(x, y), info.crop });
+				x += info.xadvance;
+			});
+			// rasterizing may have evicted pages, so only read the epoch afterwards
+			m_epoch = m_fonts->glyph_epoch();
+			m_size = { x, fontInfo.ascent - fontInfo.descent };
+
+			// one draw per atlas page
+			std::stable_sort(quads.begin(), quads.end(), [](const Quad &a, const Quad &b) { return a.page < b.page; });
+
+			std::vector<Vertex> vertices;
+			vertices.reserve(quads.size() * 6);
+			m_batches.clear();
+			for (const auto &q : quads) {
+				if (m_batches.empty() || m_batches.back().page != q.page)
+					m_batches.push_back({ q.page, (int)vertices.size(), 0 });
+				glm::vec2 texsize = internal::resolve_texture(m_fonts->tex(q.page)).size();
+				Rect uv = { q.crop.pos / texsize, q.crop.size / texsize };
+				const Rect &r = q.rect;
+				Vertex quad[6] = {
+					{{r.left(),  r.top(),    0.0f}, {uv.left(),  uv.top()},    m_color},
+					{{r.right(), r.top(),    0.0f}, {uv.right(), uv.top()},    m_color},
+					{{r.left(),  r.bottom(), 0.0f}, {uv.left(),  uv.bottom()}, m_color},
+					{{r.right(), r.top(),    0.0f}, {uv.right(), uv.top()},    m_color},
+					{{r.right(), r.bottom(), 0.0f}, {uv.right(), uv.bottom()}, m_color},
+					{{r.left(),  r.bottom(), 0.0f}, {uv.left(),  uv.bottom()}, m_color},
+				};
+				vertices.insert(vertices.end(), quad, quad + 6);
+				m_batches.back().count += 6;
+			}
+
+			if (!m_vao) {
+				glGenVertexArrays(1, &m_vao);
+				glGenBuffers(1, &m_vbo);
+				glBindVertexArray(m_vao);
+				glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, pos));
+				glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, uv));
+				glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, color));
+				glEnableVertexAttribArray(0);
+				glEnableVertexAttribArray(1);
+				glEnableVertexAttribArray(2);
+				glBindVertexArray(internal::g_VAO);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, internal::g_VBO);
+		}
+
+		std::string m_text;
+		FontAtlas::object_ref m_fonts = { 0 };
+		int m_fontIndex = 0;
+		bool m_hasFont = false;
+		glm::vec4 m_color = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+		bool m_dirty = true;
+		unsigned int m_epoch = 0;
+		glm::vec2 m_size = { 0.0f, 0.0f };
+		std::vector<Batch> m_batches;
+		GLuint m_vao = 0;
+		GLuint m_vbo = 0;
+	};
+
+	Text::Text() : impl(new TextImpl) {}
+	Text::Text(FontAtlas::object_ref fonts, int fontIndex, const char *text, glm::vec4 color) : impl(new TextImpl) {
+		impl->set_font(fonts, fontIndex);
+		impl->set_text(text);
+		impl->set_color(color);
 	}
+	Text::Text(Text && other) : impl{ nullptr } { impl.swap(other.impl); }
+	Text & Text::operator=(Text && other) {
+		if (&other != this) {
+			impl.swap(other.impl);
+		}
+		return *this;
+	}
+	Text::~Text() = default;
+	void Text::set_text(const char *text) { impl->set_text(text); }
+	void Text::set_font(FontAtlas::object_ref fonts, int fontIndex) { impl->set_font(fonts, fontIndex); }
+	void Text::set_color(glm::vec4 color) { impl->set_color(color); }
+	glm::vec2 Text::size() { return impl->size(); }
+	void Text::draw(float x, float y) { impl->draw({ x, y, 0.0f }); }
+	void Text::draw(glm::vec3 offset) { impl->draw(offset); }
 
 	// ...
 
+	struct EventHandler::impl {
+		struct Hook {
+			HookId id;
+			HandlerFunc func;
+			bool removed;
+		};
+		// the handlers of 256 consecutive event types, allocated when one of them is first hooked
+		struct Block {
+			std::vector<Hook> slots[256];
+		};
+		std::unique_ptr<Block> blocks[256];
+		uint64_t nextSerial = 1;
+
+		// hooks changed while dispatching are applied once the outermost dispatch returns
+		int dispatching = 0;
+		std::vector<Hook> added;
+		bool removed = false;
+
+		bool coalesce = false;
+		bool pending = false;
+		SDL_Event held;
+		// arrival of the last event merged into held, it is dispatched later from within another event
+		uint64_t heldTimestamp = 0;
+
+		std::vector<Hook> *slot(uint32_t type, bool create) {
+			if (type > 0xFFFF)
+				return nullptr;
+			auto &block = blocks[type >> 8];
+			if (!block) {
+				if (!create)
+					return nullptr;
+				block = std::make_unique<Block>();
+			}
+			return &block->slots[type & 0xFF];
+		}
+
+		void dispatch(SDL_Event *e) {
+			std::vector<Hook> *hooks = slot(e->type, false);
+			if (!hooks)
+				return;
+			dispatching++;
+			for (size_t i = 0; i < hooks->size(); i++) {
+				if (!(*hooks)[i].removed)
+					(*hooks)[i].func(e);
+			}
+			if (--dispatching == 0)
+				apply_changes();
+		}
+
+		void apply_changes() {
+			if (removed) {
+				for (auto &block : blocks) {
+					if (!block)
+						continue;
+					for (auto &hooks : block->slots)
+						hooks.erase(std::remove_if(hooks.begin(), hooks.end(), [](const Hook &h) { return h.removed; }), hooks.end());
+				}
+				removed = false;
+			}
+			for (auto &h : added)
+				slot((uint32_t)(h.id & 0xFFFF), true)->push_back(std::move(h));
+			added.clear();
+		}
+
+		// folds e into the held event when both are motion or wheel events of the same mouse and window
+		bool merge(const SDL_Event *e) {
+			if (!pending || held.type != e->type)
+				return false;
+			if (e->type == SDL_MOUSEMOTION) {
+				auto &a = held.motion;
+				const auto &b = e->motion;
+				// a button change in between has to reach the handlers in order
+				if (a.windowID != b.windowID || a.which != b.which || a.state != b.state)
+					return false;
+				a.timestamp = b.timestamp;
+				a.x = b.x;
+				a.y = b.y;
+				a.xrel += b.xrel;
+				a.yrel += b.yrel;
+				return true;
+			}
+			if (e->type == SDL_MOUSEWHEEL) {
+				auto &a = held.wheel;
+				const auto &b = e->wheel;
+				if (a.windowID != b.windowID || a.which != b.which || a.direction != b.direction)
+					return false;
+				a.timestamp = b.timestamp;
+				a.x += b.x;
+				a.y += b.y;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+				a.preciseX += b.preciseX;
+				a.preciseY += b.preciseY;
+#endif
+				return true;
+			}
+			return false;
+		}
+	};
+
 	EventHandler::EventHandler() : pImpl(std::make_unique<impl>()) {}
 	EventHandler::~EventHandler() = default;
 
-	struct EventHandler::impl {
-		std::map<uint32_t, HandlerFunc> handlers;
-	};
+	EventHandler::HookId EventHandler::hook(uint32_t type, HandlerFunc func) {
+		// the low 16 bits hold the type, so unhooking finds the slot without a search through every table
+		assert(type <= 0xFFFF);
+		HookId id = (pImpl->nextSerial++ << 16) | (type & 0xFFFF);
+		if (pImpl->dispatching)
+			pImpl->added.push_back({ id, std::move(func), false });
+		else
+			pImpl->slot(type, true)->push_back({ id, std::move(func), false });
+		return id;
+	}
+
+	void EventHandler::unhook(HookId id) {
+		std::vector<impl::Hook> *hooks = pImpl->slot((uint32_t)(id & 0xFFFF), false);
+		if (hooks) {
+			for (auto it = hooks->begin(); it != hooks->end(); ++it) {
+				if (it->id != id)
+					continue;
+				if (pImpl->dispatching) {
+					// the handler may be running right now, it is erased after the dispatch
+					it->removed = true;
+					pImpl->removed = true;
+				}
+				else {
+					hooks->erase(it);
+				}
+				return;
+			}
+		}
+		auto &added = pImpl->added;
+		added.erase(std::remove_if(added.begin(), added.end(), [id](const impl::Hook &h) { return h.id == id; }), added.end());
+	}
 
-	void EventHandler::hook(uint32_t type, HandlerFunc func) {
-		pImpl->handlers.insert_or_assign(type, func);
+	void EventHandler::set_coalescing(bool coalesce) {
+		if (!coalesce)
+			flush();
+		pImpl->coalesce = coalesce;
 	}
 
 	void EventHandler::handle(void *e) {
-		auto f = pImpl->handlers.find(static_cast<SDL_Event*>(e)->type);
-		if (f != pImpl->handlers.end()) {
-			f->second(e);
+		SDL_Event *event = static_cast<SDL_Event*>(e);
+		if (pImpl->coalesce) {
+			if (pImpl->merge(event)) {
+				pImpl->heldTimestamp = internal::g_eventTimestamp;
+				return;
+			}
+			flush();
+			if (event->type == SDL_MOUSEMOTION || event->type == SDL_MOUSEWHEEL) {
+				pImpl->held = *event;
+				pImpl->heldTimestamp = internal::g_eventTimestamp;
+				pImpl->pending = true;
+				return;
+			}
 		}
+		pImpl->dispatch(event);
+	}
+
+	void EventHandler::flush() {
+		if (!pImpl->pending)
+			return;
+		pImpl->pending = false;
+		// a copy, handlers may feed more events in while this one runs
+		SDL_Event event = pImpl->held;
+		// the held event reports its own arrival, the event that flushed it gets its own back afterwards
+		uint64_t timestamp = internal::g_eventTimestamp;
+		internal::g_eventTimestamp = pImpl->heldTimestamp;
+		pImpl->dispatch(&event);
+		internal::g_eventTimestamp = timestamp;
 	}
 
 	// ...
@@ -546,6 +2456,44 @@ void main()
 	std::shared_ptr<EventHandler> g_eventhandler;
 	bool g_quit = false;
 
+	namespace internal {
+		struct QueuedEvent {
+			SDL_Event event;
+			uint64_t timestamp;
+		};
+
+		static InputMode g_inputMode = InputMode::Polled;
+		static SpscQueue<QueuedEvent> g_inputQueue(1024);
+		// the thread that pumps SDL, the only one allowed to fill the queue
+		static SDL_threadID g_inputThread = 0;
+		// whether input_latch ran since the frame function was called
+		static bool g_latched = false;
+		static uint64_t g_swapTimestamp = 0;
+		// the application's own filter, still called first while ours is installed
+		static SDL_EventFilter g_prevFilter = nullptr;
+		static void *g_prevFilterData = nullptr;
+
+		// a filter rather than an event watch, so the events taken into the queue don't also stay in SDL's queue
+		static int input_filter(void *userdata, SDL_Event *event) {
+			if (g_prevFilter && !g_prevFilter(g_prevFilterData, event))
+				return 0;
+			// events pushed from other threads, or arriving while the queue is full, wait in SDL's queue instead
+			if (SDL_ThreadID() != g_inputThread)
+				return 1;
+			if (!g_inputQueue.push({ *event, SDL_GetPerformanceCounter() }))
+				return 1;
+			return 0;
+		}
+
+		static void dispatch_event(SDL_Event *event, uint64_t timestamp) {
+			g_eventTimestamp = timestamp;
+			if (event->type == SDL_QUIT)
+				g_quit = true;
+			if (g_eventhandler)
+				g_eventhandler->handle(event);
+		}
+	}
+
 	void window(int width, int height) {
 		internal::create_window(width, height);
 	}
@@ -558,6 +2506,46 @@ void main()
 		g_eventhandler = handler;
 	}
 
+	void set_input_mode(InputMode mode) {
+		if (mode == internal::g_inputMode)
+			return;
+		internal::g_inputMode = mode;
+		if (mode == InputMode::Latched) {
+			internal::g_inputThread = SDL_ThreadID();
+			if (!SDL_GetEventFilter(&internal::g_prevFilter, &internal::g_prevFilterData))
+				internal::g_prevFilter = nullptr;
+			SDL_SetEventFilter(internal::input_filter, nullptr);
+		}
+		else {
+			// whatever is still queued goes out with the next input_latch
+			SDL_SetEventFilter(internal::g_prevFilter, internal::g_prevFilterData);
+			internal::g_prevFilter = nullptr;
+			internal::g_prevFilterData = nullptr;
+		}
+	}
+
+	void input_latch() {
+		internal::g_latched = true;
+		SDL_PumpEvents();
+		internal::QueuedEvent queued;
+		while (internal::g_inputQueue.pop(&queued))
+			internal::dispatch_event(&queued.event, queued.timestamp);
+		// everything in polled mode, only leftovers from other threads in latched mode
+		SDL_Event sdlEvent;
+		while (SDL_PollEvent(&sdlEvent) != 0)
+			internal::dispatch_event(&sdlEvent, SDL_GetPerformanceCounter());
+		if (g_eventhandler)
+			g_eventhandler->flush();
+	}
+
+	uint64_t input_timestamp() {
+		return internal::g_eventTimestamp;
+	}
+
+	uint64_t swap_timestamp() {
+		return internal::g_swapTimestamp;
+	}
+
 	void run() {
 		internal::requires_window();
 
@@ -567,32 +2555,45 @@ void main()
 		const uint32_t minimumFrameTicks = 1000 / fpsLimit;
 
 		g_quit = false;
-		SDL_Event sdlEvent;
 		uint32_t lastTicks = SDL_GetTicks();
 		while (!g_quit) {
 			uint32_t currentTicks = SDL_GetTicks();
 			uint32_t deltaTicks = currentTicks - lastTicks;
 			lastTicks = currentTicks;
 
-			while (SDL_PollEvent(&sdlEvent) != 0) {
-				if (sdlEvent.type == SDL_QUIT) {
-					g_quit = true;
-				}
-				if (g_eventhandler)
-					g_eventhandler->handle(&sdlEvent);
-			}
+			if (internal::g_inputMode == InputMode::Polled)
+				input_latch();
+			internal::g_latched = false;
+
+			internal::process_uploads();
 
 			float deltaTime = deltaTicks * 0.001f;
 
 			if (g_framefunc)
 				g_framefunc(deltaTime);
 
+			// events must not pile up when the frame function never latches
+			if (internal::g_inputMode == InputMode::Latched && !internal::g_latched)
+				input_latch();
+
+			internal::evict_textures();
+
 			ursa::internal::swap_window();
+			internal::g_swapTimestamp = SDL_GetPerformanceCounter();
 			
 			// limit fps because swapwindow doesn't necessarily wait (e.g. if the window is completely hidden)
 			uint32_t frameTicks = SDL_GetTicks() - currentTicks;
 			if (frameTicks < minimumFrameTicks) {
-				SDL_Delay(minimumFrameTicks - frameTicks);
+				if (internal::g_inputMode == InputMode::Latched) {
+					// keep pumping while waiting, so queued events carry the time they came in rather than the next frame's
+					while (SDL_GetTicks() - currentTicks < minimumFrameTicks) {
+						SDL_Delay(1);
+						SDL_PumpEvents();
+					}
+				}
+				else {
+					SDL_Delay(minimumFrameTicks - frameTicks);
+				}
 			}
 		}
 		ursa::internal::quit();
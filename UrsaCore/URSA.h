@@ -1,8 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -49,6 +55,12 @@ namespace ursa {
 		Rect(float x, float y, float width, float height) : pos(x, y), size(width, height) {}
 
 		Rect operator*(const glm::vec2 &scale) { return { pos*scale, size*scale }; }
+		// the overlapping part, with a size of 0 when there is none
+		Rect intersect(const Rect &other) const {
+			glm::vec2 topleft = glm::max(pos, other.pos);
+			glm::vec2 bottomright = glm::min(pos + size, other.pos + other.size);
+			return { topleft, glm::max(bottomright - topleft, glm::vec2(0.0f)) };
+		}
 
 		bool contains(const glm::vec2 &point) { return (point.x > pos.x) && (point.x < pos.x + size.x) && (point.y > pos.y) && (point.y < pos.y+size.y); }
 	};
@@ -56,49 +68,226 @@ namespace ursa {
 	struct TextureHandle {
 		unsigned int handle;
 		// Carrying metadata with the handle to avoid lookups
-		// The downside is that different copies of the handle might get out of sync
-		// TODO consider some shared_ptr mechanic to automatically delete the opengl resources and keep metadata in sync
-		// TODO consider some Ref<type> object pools as seen in http://etodd.io/2018/02/20/poor-mans-netcode/
+		// copies might get out of sync, drawing goes through the texture registry which holds the current values
 		int width, height;
 		enum TextureKind {
-			RGBA, Alpha
+			// Distance holds a signed distance field with the edge at 0.5
+			RGBA, Alpha, Distance
 		} kind = RGBA;
+		// registry slot and generation, 0 for handles the registry doesn't know about
+		unsigned int id = 0;
 
 		glm::vec2 size() { return { (float)width, (float)height }; }
 		Rect bounds() { return Rect((float)width, (float)height); }
 	};
 
-	// managed object system for objects that are never unallocated during runtime
+	struct TextureDesc {
+		enum class Mips { None, Generate, Provided } mips = Mips::Generate;
+		enum class Filter { Nearest, Linear } filter = Filter::Linear;
+		enum class Wrap { Clamp, Repeat, Mirror } wrap = Wrap::Repeat;
+		// Auto picks the format matching the source channels
+		enum class Format { Auto, RGBA8, RGB8, R8, SRGB8_ALPHA8 } format = Format::Auto;
+		// allocate with glTexStorage2D when the driver supports it
+		bool immutable = true;
+		// optional CPU block compression, Auto picks BC4, BC1 or BC3 by channel count
+		// textures stay uncompressed when the driver lacks the format
+		enum class Compression { None, Auto, BC1, BC3, BC4 } compression = Compression::None;
+		enum class CompressionQuality { Fast, High } compressionQuality = CompressionQuality::Fast;
+	};
+
+	struct TextureMemoryStats {
+		int residentTextures;
+		int evictedTextures;
+		size_t residentBytes;
+		// 0 when unlimited
+		size_t budgetBytes;
+
+		int compressedTextures;
+		// what the compressed textures would take as plain pixels, compare against compressedBytes
+		size_t uncompressedBytes;
+		size_t compressedBytes;
+	};
+
+	struct ResourceCacheStats {
+		int textureHits;
+		int textureMisses;
+		// textures currently shared through the cache
+		int sharedTextures;
+		int fileHits;
+		int fileMisses;
+		int mappedFiles;
+	};
+
+	// owns one reference to a registered texture, releases it when the last copy goes away
+	class TextureRef {
+	public:
+		TextureRef() = default;
+		// adopts the reference returned by texture() and friends
+		TextureRef(TextureHandle tex) : m_tex(tex) {}
+		TextureRef(const TextureRef &other);
+		TextureRef(TextureRef &&other) noexcept : m_tex(other.m_tex) { other.m_tex = { 0 }; }
+		TextureRef& operator=(TextureRef other) noexcept { std::swap(m_tex, other.m_tex); return *this; }
+		~TextureRef();
+
+		operator TextureHandle() const { return m_tex; }
+		const TextureHandle& get() const { return m_tex; }
+	private:
+		TextureHandle m_tex = { 0 };
+	};
+
+	// a range of indices drawn with one texture, untextured when the handle is 0
+	// clip is in window pixels, an empty clip draws unclipped
+	struct DrawCommand {
+		TextureHandle texture;
+		Rect clip;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+
+	// vertices with this uv ignore the bound texture, so solid quads can join a textured draw
+	const float untextured_uv = -65536.0f;
+
+	// managed object system
+	// objects live in fixed size chunks that never move, so pointers from ref() stay valid while more objects are
+	// created; destroyed slots are reused from a free list with a new generation, so references to a destroyed object
+	// stop being valid() instead of reaching whatever took the slot over
 
 	template<typename T> struct ObjectRef {
-		short id;
-		inline T* ref() const { return T::get_instance(id);	}
+		uint32_t index;
+		// 0 for the null reference, live objects start at 1
+		uint32_t generation;
+
+		// nullptr for null and stale references
+		inline T* ref() const { return T::get_instance(*this); }
 
 		inline T& operator*() const { return *ref(); }
 		inline T* operator->() const noexcept { return ref(); }
 
-		// TODO operator=
+		bool valid() const { return ref() != nullptr; }
+		explicit operator bool() const { return valid(); }
+		bool operator==(const ObjectRef &other) const { return index == other.index && generation == other.generation; }
+		bool operator!=(const ObjectRef &other) const { return !(*this == other); }
 	};
 
 	template<typename T> class Object {
 	public:
 		using object_ref = ObjectRef<T>;
 
-		short get_id() const {
-			return this - s_instances.data();
+		object_ref get_ref() const {
+			// the object is the first member of its slot
+			const Slot *slot = reinterpret_cast<const Slot*>(static_cast<const T*>(this));
+			return { slot->index, slot->state.load(std::memory_order_acquire) >> 1 };
 		}
 
-		static T* get_instance(short id) {
-			return &s_instances[id];
+		static T* get_instance(object_ref ref) {
+			if (!ref.generation || ref.index >= max_chunks * chunk_size)
+				return nullptr;
+			Slot *chunk = s_pool.chunks[ref.index / chunk_size].load(std::memory_order_acquire);
+			if (!chunk)
+				return nullptr;
+			Slot &slot = chunk[ref.index % chunk_size];
+			// pairs with the release store after construction, a live state means the object is fully built
+			if (slot.state.load(std::memory_order_acquire) != live_state(ref.generation))
+				return nullptr;
+			return slot.object();
 		}
 
 		template<class... Args>
 		static object_ref create_instance(Args&&... args) {
-			s_instances.emplace_back(std::forward<Args>(args)...);
-			return { static_cast<short>(s_instances.size() - 1) };
+			std::unique_lock<std::mutex> lock(s_pool.mutex, std::defer_lock);
+			if (s_pool.threadSafe)
+				lock.lock();
+
+			uint32_t index;
+			if (!s_pool.freeList.empty()) {
+				index = s_pool.freeList.back();
+				s_pool.freeList.pop_back();
+			}
+			else {
+				index = s_pool.used++;
+				assert(index < max_chunks * chunk_size);
+				auto &chunk = s_pool.chunks[index / chunk_size];
+				if (!chunk.load(std::memory_order_relaxed)) {
+					Slot *slots = new Slot[chunk_size];
+					for (uint32_t i = 0; i < chunk_size; i++)
+						slots[i].index = index + i;
+					// published after the slots are set up, get_instance reads the pointer without the lock
+					chunk.store(slots, std::memory_order_release);
+				}
+			}
+			Slot &slot = s_pool.chunks[index / chunk_size].load(std::memory_order_relaxed)[index % chunk_size];
+			uint32_t generation = slot.state.load(std::memory_order_relaxed) >> 1;
+			new (slot.storage) T(std::forward<Args>(args)...);
+			slot.state.store(live_state(generation), std::memory_order_release);
+			return { index, generation };
 		}
+
+		// references to the object stop being valid, its slot goes to the next object created
+		static void destroy_instance(object_ref ref) {
+			std::unique_lock<std::mutex> lock(s_pool.mutex, std::defer_lock);
+			if (s_pool.threadSafe)
+				lock.lock();
+
+			T *object = get_instance(ref);
+			if (!object)
+				return;
+			Slot *slot = reinterpret_cast<Slot*>(object);
+			// generation 0 stays reserved for null references
+			uint32_t generation = (ref.generation + 1) & generation_mask;
+			if (generation == 0)
+				generation = 1;
+			// dead before the destructor runs, so lookups stop finding the object first
+			slot->state.store(generation << 1, std::memory_order_release);
+			object->~T();
+			s_pool.freeList.push_back(slot->index);
+		}
+
+		// lets several threads create and destroy objects at the same time, looking objects up never locks
+		// destroying an object another thread is still using isn't made safe by this
+		static void set_thread_safe(bool threadSafe) {
+			s_pool.threadSafe = threadSafe;
+		}
+
 	private:
-		static std::vector<T> s_instances;
+		static const uint32_t chunk_size = 256;
+		// chunk pointers are a fixed array rather than a vector, so lookups never race with the array growing
+		static const uint32_t max_chunks = 4096;
+
+		// generations use 31 bits, the low bit of a slot's state tells whether it holds a live object
+		static const uint32_t generation_mask = ~0u >> 1;
+		static uint32_t live_state(uint32_t generation) { return (generation << 1) | 1; }
+
+		struct Slot {
+			alignas(T) unsigned char storage[sizeof(T)];
+			uint32_t index = 0;
+			// generation and alive flag in one atomic, so lookups without the lock see them change together
+			std::atomic<uint32_t> state{ 1u << 1 };
+
+			T *object() { return reinterpret_cast<T*>(storage); }
+		};
+
+		struct Pool {
+			std::atomic<Slot*> chunks[max_chunks] = {};
+			uint32_t used = 0;
+			std::vector<uint32_t> freeList;
+			std::mutex mutex;
+			bool threadSafe = false;
+
+			~Pool() {
+				for (auto &chunk : chunks) {
+					Slot *slots = chunk.load(std::memory_order_relaxed);
+					if (!slots)
+						continue;
+					for (uint32_t i = 0; i < chunk_size; i++) {
+						if (slots[i].state.load(std::memory_order_relaxed) & 1)
+							slots[i].object()->~T();
+					}
+					delete[] slots;
+				}
+			}
+		};
+
+		inline static Pool s_pool;
 	};
 
 	class FontAtlas : public Object<FontAtlas> {
@@ -107,6 +296,10 @@ namespace ursa {
 			Rect crop;
 			Rect bounds;
 			float xadvance;
+			// texture the crop refers to, see tex()
+			int page;
+			// there was no room to rasterize the glyph this frame, it is tried again when asked for next time
+			bool pending = false;
 		};
 
 		struct FontInfo {
@@ -117,12 +310,31 @@ namespace ursa {
 		
 		void add_truetype(const char *filename, float font_size);
 		void add_truetype(const char *filename, std::initializer_list<float> font_sizes);
-
-		void bake(int texwidth, int texheight);
-
-		TextureHandle tex() const;
+		// glyphs are stored once as signed distance fields rendered at sdf_size and shared by all the sizes,
+		// they stay sharp when scaled up or drawn under transform_3d
+		void add_truetype_sdf(const char *filename, std::initializer_list<float> font_sizes, float sdf_size = 32.0f);
+
+		// with a cachefile the baked bitmap and glyph data are stored there and reused on later runs
+		// as long as the font files, sizes and texture size are unchanged
+		void bake(int texwidth, int texheight, const char *cachefile = nullptr);
+
+		// codepoints outside the baked ASCII range are rasterized on first use into pages of pageSize^2
+		// once maxPages are full the least recently drawn page is cleared and reused
+		void glyph_cache(int pageSize, int maxPages);
+
+		// page 0 is the baked atlas, higher pages hold glyphs rasterized on demand
+		TextureHandle tex(int page = 0) const;
+		// marks a page as drawn this frame, for geometry kept across frames that doesn't go through glyphInfo
+		void touch(int page) const;
+		// changes whenever glyphs may have moved (rebake, page eviction), geometry built earlier is stale then
+		unsigned int glyph_epoch() const;
 		GlyphInfo glyphInfo(int fontIndex, int codepoint) const;
 		FontInfo fontInfo(int fontIndex) const;
+		// horizontal adjustment between two neighbouring glyphs, added to the advance of the first
+		float kerning(int fontIndex, int first, int second) const;
+		// advance width of length bytes of UTF-8 including kerning, without rasterizing or building geometry
+		// ASCII runs are summed from flat per-font tables
+		float measure_run(int fontIndex, const char *text, size_t length) const;
 
 		// don't construct directly, can't be made private because needs to work inside vector
 		FontAtlas();
@@ -136,21 +348,95 @@ namespace ursa {
 		std::unique_ptr<class FontAtlasImpl> impl;
 	};
 
+	// a string laid out once with its glyph quads kept in a GPU buffer, drawing it costs one call per atlas page
+	// layout is only redone when the string, font or color changes
+	class Text {
+	public:
+		Text();
+		Text(FontAtlas::object_ref fonts, int fontIndex, const char *text, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
+		Text(Text && other);
+		Text& operator=(Text && other);
+		~Text();
+
+		void set_text(const char *text);
+		void set_font(FontAtlas::object_ref fonts, int fontIndex);
+		void set_color(glm::vec4 color);
+
+		// advance width by line height (ascent - descent)
+		glm::vec2 size();
+
+		// draws with the top left corner at the given position, the offset goes through the current transform
+		void draw(float x, float y);
+		void draw(glm::vec3 offset);
+
+	private:
+		std::unique_ptr<class TextImpl> impl;
+	};
+
+	// handlers live in a two level table indexed by the high and low byte of the event type, so dispatching is two
+	// array lookups; several handlers of one type run in the order they were hooked
 	class EventHandler {
 		using HandlerFunc = std::function<void(void *)>;
 		struct impl;
 		std::unique_ptr<impl> pImpl;
 	public:
+		using HookId = uint64_t;
+
 		EventHandler();
 		~EventHandler();
-		// TODO do we need multiple handlers for single event? do we need unhooking?
-		void hook(uint32_t type, HandlerFunc func);
+		HookId hook(uint32_t type, HandlerFunc func);
+		// safe to call from a handler, including the one being removed
+		void unhook(HookId id);
+
+		// merges runs of consecutive mouse motion or wheel events into one, e.g. for high polling rate mice
+		// the merged event has the last position and the summed relative motion, a merged event is held back
+		// until an event that doesn't merge arrives or flush is called
+		void set_coalescing(bool coalesce);
 		void handle(void *e);
+		// dispatches the held back event, run() calls this after every batch of events
+		void flush();
 	};
 
-	TextureHandle texture(const char *filename);
-	TextureHandle texture(int width, int height, const void *data);
-	TextureHandle texture8bpp(int width, int height, const void *data);
+	// replace a region of an existing texture in place, e.g. for video frames or CPU-rendered canvases
+	// pixels are tightly packed RGBA, or 8bpp for alpha textures; the data is staged through a ring of
+	// pixel buffers so the call never waits for the GPU
+	void texture_update(TextureHandle tex, Rect subrect, const void *pixels, bool regenerate_mips = true);
+
+	enum class UploadPriority { Low, Normal, High };
+
+	// loading the same file with the same parameters again returns the already loaded texture with an extra reference
+	TextureHandle texture(const char *filename, const TextureDesc &desc = {});
+	// loads through a preprocessed cache file holding the decoded image and its full mip chain (filename + ".utc" by default)
+	// the cache is rebuilt on first use, or when the source's size and timestamp change and its contents hash differs
+	TextureHandle texture_cached(const char *filename, const TextureDesc &desc = {}, const char *cachefile = nullptr);
+	// offline conversion for build steps, compression trades load time for disk space
+	// the cache stores block compressed levels when desc asks for compression
+	bool texture_cache_build(const char *filename, const char *cachefile = nullptr, bool compress = false, const TextureDesc &desc = {});
+
+	// every texture starts with one reference held by the caller
+	// releasing the last one deletes the GL texture, stale copies of the handle then draw nothing
+	void texture_retain(TextureHandle tex);
+	void texture_release(TextureHandle tex);
+	// false once the texture has been released, evicted textures are still valid
+	bool texture_valid(TextureHandle tex);
+
+	// textures loaded from files can be evicted when resident textures exceed the budget, least recently drawn first
+	// evicted textures are reloaded synchronously the next time they are drawn, 0 disables the budget
+	void texture_budget(size_t bytes);
+	TextureMemoryStats texture_memory_stats();
+	ResourceCacheStats resource_cache_stats();
+
+	// returns a placeholder immediately, the image is decoded on a worker thread and uploaded during later frames
+	// on_ready is called on the render thread with the final handle, or a handle of 0 if decoding failed
+	TextureHandle texture_async(const char *filename, std::function<void(TextureHandle)> on_ready = nullptr, UploadPriority priority = UploadPriority::Normal);
+
+	// pending uploads are drained once per frame until either limit is hit, large textures are split into bands of rows
+	void upload_budget(float milliseconds, size_t bytes);
+	// defer arbitrary GPU uploads (mesh buffers, atlas pages, ...) to the frame-budgeted upload queue
+	void upload_enqueue(size_t bytes, std::function<void()> upload, UploadPriority priority = UploadPriority::Normal);
+	// with Mips::Provided, data holds every mip level tightly packed one after another
+	TextureHandle texture(int width, int height, const void *data, const TextureDesc &desc = {});
+	TextureHandle texture8bpp(int width, int height, const void *data, const TextureDesc &desc = {});
 
 	ObjectRef<FontAtlas> font_atlas();
 
@@ -167,6 +453,8 @@ namespace ursa {
 	void draw_triangles(Vertex vertices[], int count);
 	void draw_points(Vertex vertices[], int count);
 	void draw_lines(Vertex vertices[], int count);
+	// uploads the vertices and indices once and issues one draw per command
+	void draw_indexed(const Vertex vertices[], int vertexCount, const uint32_t indices[], int indexCount, const DrawCommand commands[], int commandCount);
 
 	void draw_rect(Rect rect, glm::vec4 color = {1.0f, 1.0f, 1.0f, 1.0f});
 	void draw_rect(TextureHandle tex, Rect rect, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
@@ -178,12 +466,31 @@ namespace ursa {
 	void draw_9patch(TextureHandle tex, Rect rect, int margin, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
 
 	void draw_text(FontAtlas::object_ref fonts, int fontIndex, float x, float y, const char *text, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
+	// length bytes of UTF-8 that don't need to be terminated
+	void draw_text(FontAtlas::object_ref fonts, int fontIndex, float x, float y, const char *text, size_t length, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
+	// the size draw_text would cover: advance width by line height (ascent - descent)
+	glm::vec2 measure_text(FontAtlas::object_ref fonts, int fontIndex, const char *text);
 
 	void window(int width, int height);
 	void set_framefunc(std::function<void(float)> framefunc);
 
 	void set_eventhandler(const std::shared_ptr<EventHandler> &handler);
 
+	// Polled dispatches the events once per frame, right before the frame function
+	// Latched has SDL hand events over as it pumps them, timestamped into a lock-free queue, and leaves dispatching
+	// to input_latch(), which the frame function calls as late as it can, e.g. right before it reads the mouse
+	enum class InputMode { Polled, Latched };
+	void set_input_mode(InputMode mode);
+	// pumps SDL and dispatches everything that arrived so far, run() calls it after the frame function when the
+	// frame function didn't
+	void input_latch();
+	// performance counter ticks (SDL_GetPerformanceCounter) at which the event being dispatched arrived, a coalesced
+	// event reports the last event merged into it
+	// in Polled mode, and for events pushed from other threads, this is when the event was dispatched instead
+	uint64_t input_timestamp();
+	// performance counter ticks right after the last buffer swap, later swaps minus input timestamps give input to photon latency
+	uint64_t swap_timestamp();
+
 	void run();
 	void terminate();
 }
@@ -0,0 +1,219 @@
+#include "file.h"
+
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ursa {
+
+	MappedFile::MappedFile(const char *filename) {
+#ifdef _WIN32
+		HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			CloseHandle(file);
+			return;
+		}
+		void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return;
+		}
+		m_file = file;
+		m_mapping = mapping;
+		m_data = static_cast<const uint8_t*>(view);
+		m_size = (size_t)size.QuadPart;
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return;
+		}
+		void *view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// the mapping keeps its own reference to the file
+		::close(fd);
+		if (view == MAP_FAILED)
+			return;
+		m_data = static_cast<const uint8_t*>(view);
+		m_size = (size_t)st.st_size;
+#endif
+	}
+
+	MappedFile::MappedFile(MappedFile &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile &&other) noexcept {
+		if (&other != this) {
+			close();
+			m_data = other.m_data;
+			m_size = other.m_size;
+			other.m_data = nullptr;
+			other.m_size = 0;
+#ifdef _WIN32
+			m_file = other.m_file;
+			m_mapping = other.m_mapping;
+			other.m_file = nullptr;
+			other.m_mapping = nullptr;
+#endif
+		}
+		return *this;
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	void MappedFile::close() {
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file)
+			CloseHandle(m_file);
+		m_file = nullptr;
+		m_mapping = nullptr;
+#else
+		if (m_data)
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	namespace {
+		// weak so mappings go away with their last user and the files can be replaced on disk
+		std::mutex g_mappedMutex;
+		std::unordered_map<std::string, std::weak_ptr<const MappedFile>> g_mapped;
+		FileCacheStats g_mappedStats = { 0, 0, 0 };
+	}
+
+	std::shared_ptr<const MappedFile> file_mapped(const char *filename) {
+		std::string key = normalize_path(filename);
+
+		std::lock_guard<std::mutex> lock(g_mappedMutex);
+		auto &slot = g_mapped[key];
+		if (auto file = slot.lock()) {
+			g_mappedStats.hits++;
+			return file;
+		}
+		g_mappedStats.misses++;
+		auto file = std::make_shared<const MappedFile>(filename);
+		slot = file;
+		return file;
+	}
+
+	FileCacheStats file_cache_stats() {
+		std::lock_guard<std::mutex> lock(g_mappedMutex);
+		FileCacheStats stats = g_mappedStats;
+		stats.mapped = 0;
+		for (auto it = g_mapped.begin(); it != g_mapped.end();) {
+			if (it->second.expired()) {
+				it = g_mapped.erase(it);
+			} else {
+				stats.mapped++;
+				++it;
+			}
+		}
+		return stats;
+	}
+
+	std::string normalize_path(const char *path) {
+		std::string p = path;
+		for (auto &c : p) {
+			if (c == '\\')
+				c = '/';
+#ifdef _WIN32
+			c = (char)tolower((unsigned char)c);
+#endif
+		}
+
+		// keep a leading root ("/" or a drive letter) out of the component list
+		std::string root;
+		size_t start = 0;
+		if (p.size() >= 2 && p[1] == ':')
+			start = 2;
+		if (start < p.size() && p[start] == '/')
+			start++;
+		root = p.substr(0, start);
+
+		std::vector<std::string> parts;
+		size_t i = start;
+		while (i <= p.size()) {
+			size_t end = p.find('/', i);
+			if (end == std::string::npos)
+				end = p.size();
+			std::string part = p.substr(i, end - i);
+			if (part == "..") {
+				if (!parts.empty() && parts.back() != "..")
+					parts.pop_back();
+				else if (root.empty())
+					parts.push_back(part);
+			} else if (!part.empty() && part != ".") {
+				parts.push_back(part);
+			}
+			i = end + 1;
+		}
+
+		std::string result = root;
+		for (size_t n = 0; n < parts.size(); n++) {
+			if (n)
+				result += '/';
+			result += parts[n];
+		}
+		return result;
+	}
+
+	FileStat file_stat(const char *filename) {
+		std::error_code ec;
+		auto size = std::filesystem::file_size(filename, ec);
+		if (ec)
+			return { false, 0, 0 };
+		auto mtime = std::filesystem::last_write_time(filename, ec);
+		if (ec)
+			return { false, 0, 0 };
+		return { true, (uint64_t)size, (uint64_t)mtime.time_since_epoch().count() };
+	}
+
+	bool file_write(const char *filename, const void *data, size_t size) {
+		std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+		file.write(static_cast<const char*>(data), size);
+		return (bool)file;
+	}
+
+	uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+		const uint8_t *p = static_cast<const uint8_t*>(data);
+		uint64_t hash = seed;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= p[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+}
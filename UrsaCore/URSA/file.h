@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ursa {
+
+	// read-only memory mapping of a whole file, the mapping lives as long as the object
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		explicit MappedFile(const char *filename);
+		MappedFile(MappedFile &&other) noexcept;
+		MappedFile& operator=(MappedFile &&other) noexcept;
+		MappedFile(const MappedFile &) = delete;
+		MappedFile& operator=(const MappedFile &) = delete;
+		~MappedFile();
+
+		bool valid() const { return m_data != nullptr; }
+		const uint8_t *data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		void close();
+
+		const uint8_t *m_data{ nullptr };
+		size_t m_size{ 0 };
+#ifdef _WIN32
+		void *m_file{ nullptr };
+		void *m_mapping{ nullptr };
+#endif
+	};
+
+	struct FileStat {
+		bool exists;
+		uint64_t size;
+		// opaque timestamp, only useful for comparing against an earlier value
+		uint64_t mtime;
+	};
+
+	// shared read-only mapping, every user of the same (normalized) path gets the same mapping while any of them holds it
+	// returns an invalid mapping rather than null when the file can't be opened
+	std::shared_ptr<const MappedFile> file_mapped(const char *filename);
+
+	struct FileCacheStats {
+		int hits;
+		int misses;
+		int mapped;
+	};
+
+	FileCacheStats file_cache_stats();
+
+	// forward slashes, no "." or resolvable ".." components, case folded on Windows
+	// meant for use as a cache key, not to resolve links or relative paths
+	std::string normalize_path(const char *path);
+
+	FileStat file_stat(const char *filename);
+	bool file_write(const char *filename, const void *data, size_t size);
+
+	// 64-bit FNV-1a, pass the previous result as seed to hash data in pieces
+	uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+}
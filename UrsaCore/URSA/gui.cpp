@@ -1,42 +1,154 @@
 #include "URSA.h"
 #include "gui.h"
+#include "utf8.h"
+#include "prefixsum.h"
 
-#include <stack>
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace ursa { namespace gui {
 
+	const uint64_t no_widget = UINT64_MAX;
+	// lists, their rows and tree toggles get ids from the list and an index, so they stay the same whatever else
+	// scrolls into view; the widgets in between count up from 0
+	const uint64_t list_bit = 1ull << 62, row_bit = 1ull << 61, toggle_bit = 1ull << 60;
+
+	static uint64_t make_id(uint64_t kind, uint64_t serial, size_t index) {
+		return kind | (serial << 32) | (uint32_t)index;
+	}
+
+	// kept between frames, keyed by the list's name
+	struct ListState {
+		uint64_t serial = 0;
+		PrefixSum heights;
+		float rowHeight = 0.0f;
+		float scroll = 0.0f;
+		int columns = 1;
+
+		// during the frame: the area of the list, the next row to visit and the row being visited
+		Rect bounds;
+		size_t next = 0;
+		float nextTop = 0.0f;
+		size_t row = 0;
+		Rect rowRect;
+		int column = 0;
+
+		// trees: the depths passed this frame, which nodes are expanded and which are visible as rows
+		const int *depths = nullptr;
+		size_t nodeCount = 0;
+		std::vector<bool> expanded;
+		std::vector<uint32_t> visible;
+		bool dirty = false;
+	};
+
 	struct State {
 		// sliders, dropdown lists, etc require the widget to be active
 		// TODO should activewidget be a stack, to support silly things like sliders inside dropdown menus?
 		int activeWidget{ -1 };
-		std::stack<Rect> viewportStack;
-		std::stack<std::string> styleStack;
-		std::map<std::string, Style> styles;
+		// the stacks keep their capacity from frame to frame, so pushing doesn't allocate
+		std::vector<Rect> viewportStack;
+		std::vector<StyleId> styleStack;
+		// one entry per panel, the panel's rect cut down to the clip of its parent
+		std::vector<Rect> clipStack;
+		ClipMode clipMode{ ClipMode::scissor };
+
+		struct StyleEntry {
+			Style style;
+			bool defined;
+		};
+		// indexed by StyleId, names are only looked up when interning
+		std::vector<StyleEntry> styles;
+		std::map<std::string, StyleId, std::less<>> styleIds;
+		// styles the built-in widgets use
+		StyleId buttonStyle, textStyle, checkboxStyle, checkboxTrueStyle, checkboxFalseStyle, listStyle;
+
 		glm::vec2 mousePosition{ 0,0 };
 		bool LMB{ false };
 		bool clicked{ false };
 		FontAtlas::object_ref atlas;
 		int defaultFontIndex = -1;
 
+		// cleared every frame, the vectors keep their capacity
+		DrawList drawList;
+
+		struct HitItem {
+			Rect rect;
+			uint64_t id;
+		};
+		// the visible rects of the widgets that take input, in the order they were added so the topmost comes last
+		std::vector<HitItem> hitItems;
+		// hitItems of the last finished frame, swapped in at frame_end so the grid stays valid while the next frame fills hitItems
+		std::vector<HitItem> gridItems;
+		// built from gridItems, the items over cell c are hitCells[hitStarts[c]] up to hitStarts[c + 1]
+		std::vector<uint32_t> hitStarts, hitCells, hitFill;
+		int gridColumns = 0, gridRows = 0;
+		// the widget under the mouse in the last frame, and the last widget that asked
+		uint64_t hotId = no_widget, lastId = no_widget;
+		// wheel steps waiting for the list that was under the mouse
+		uint64_t wheelList = no_widget;
+		float wheel = 0.0f;
+
+		std::map<std::string, ListState, std::less<>> lists;
+		std::vector<ListState*> listStack;
+
 		State() {
-			styles["default"] = {
-				Style::SolidColor{ {0,0,0, 0.2f} },
-				{ {1,1,1,1} },
+			viewportStack.reserve(64);
+			styleStack.reserve(64);
+			clipStack.reserve(64);
+
+			intern("default");
+			styles[default_style] = {
+				{
+					Style::SolidColor{ {0,0,0, 0.2f} },
+					{ {1,1,1,1} },
+				},
+				true
 			};
+			buttonStyle = intern("button");
+			textStyle = intern("text");
+			checkboxStyle = intern("checkbox");
+			checkboxTrueStyle = intern("checkbox_true");
+			checkboxFalseStyle = intern("checkbox_false");
+			listStyle = intern("list");
+		}
+
+		StyleId intern(std::string_view name) {
+			auto it = styleIds.find(name);
+			if (it != styleIds.end())
+				return it->second;
+			StyleId id = (StyleId)styles.size();
+			styles.push_back({ {}, false });
+			styleIds.emplace(std::string(name), id);
+			return id;
 		}
 	};
 
 	static State state;
-	static int nextId = 0;
+	static uint64_t nextId = 0;
 
 	void set_default_font(FontAtlas::object_ref atlas, int fontIndex) {
 		state.atlas = atlas;
 		state.defaultFontIndex = fontIndex;
 	}
 
-	void set_style(std::string name, const Style &style) {
-		state.styles[name] = style;
+	void set_clip_mode(ClipMode mode) {
+		state.clipMode = mode;
+	}
+
+	StyleId style_id(std::string_view name) {
+		return state.intern(name);
+	}
+
+	void set_style(StyleId id, const Style &style) {
+		assert(id < state.styles.size());
+		state.styles[id] = { style, true };
+	}
+
+	void set_style(std::string_view name, const Style &style) {
+		set_style(state.intern(name), style);
 	}
 
 	// ...
@@ -50,22 +162,184 @@ namespace ursa { namespace gui {
 	}
 	void handle_mouseup(glm::vec2 pos) {
 		state.LMB = false;
+		state.mousePosition = pos;
 	}
 
 	void handle_mousemove(glm::vec2 pos) {
 		// TODO support sliders and drag&drop
+		state.mousePosition = pos;
+	}
+
+	// hit testing goes through a grid of 64 pixel cells over the screen, filled with the rects of the last frame
+	const float grid_cell = 64.0f;
+
+	static void grid_cells(const Rect &r, int *x0, int *y0, int *x1, int *y1) {
+		*x0 = std::max(0, (int)floor(r.left() / grid_cell));
+		*y0 = std::max(0, (int)floor(r.top() / grid_cell));
+		*x1 = std::min(state.gridColumns - 1, (int)floor(r.right() / grid_cell));
+		*y1 = std::min(state.gridRows - 1, (int)floor(r.bottom() / grid_cell));
+	}
+
+	static void build_grid() {
+		Rect screen = screenrect();
+		state.gridColumns = std::max(1, (int)ceil(screen.size.x / grid_cell));
+		state.gridRows = std::max(1, (int)ceil(screen.size.y / grid_cell));
+		size_t cells = (size_t)state.gridColumns * state.gridRows;
+
+		std::swap(state.gridItems, state.hitItems);
+		state.hitItems.clear();
+
+		// count the items of every cell, turn the counts into offsets and place the items, no per-cell vectors
+		state.hitStarts.assign(cells + 1, 0);
+		int x0, y0, x1, y1;
+		for (const auto &item : state.gridItems) {
+			grid_cells(item.rect, &x0, &y0, &x1, &y1);
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					state.hitStarts[y * state.gridColumns + x + 1]++;
+		}
+		for (size_t c = 0; c < cells; c++)
+			state.hitStarts[c + 1] += state.hitStarts[c];
+		state.hitCells.resize(state.hitStarts[cells]);
+		state.hitFill.assign(state.hitStarts.begin(), state.hitStarts.end() - 1);
+		for (uint32_t i = 0; i < state.gridItems.size(); i++) {
+			grid_cells(state.gridItems[i].rect, &x0, &y0, &x1, &y1);
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					state.hitCells[state.hitFill[y * state.gridColumns + x]++] = i;
+		}
+	}
+
+	// the topmost widget and the topmost list at pos in the last finished frame, safe to call at any time
+	static void hit_test(glm::vec2 pos, uint64_t *widget, uint64_t *list) {
+		*widget = *list = no_widget;
+		int x = (int)floor(pos.x / grid_cell);
+		int y = (int)floor(pos.y / grid_cell);
+		if (state.hitStarts.empty() || x < 0 || y < 0 || x >= state.gridColumns || y >= state.gridRows)
+			return;
+		size_t c = (size_t)y * state.gridColumns + x;
+		for (uint32_t k = state.hitStarts[c + 1]; k-- > state.hitStarts[c];) {
+			auto item = state.gridItems[state.hitCells[k]];
+			if (!item.rect.contains(pos))
+				continue;
+			if (*widget == no_widget)
+				*widget = item.id;
+			if (item.id & list_bit) {
+				*list = item.id;
+				return;
+			}
+		}
+	}
+
+	bool handle_mousewheel(glm::vec2 delta) {
+		uint64_t widget, list;
+		hit_test(state.mousePosition, &widget, &list);
+		if (list == no_widget)
+			return false;
+		if (list != state.wheelList)
+			state.wheel = 0.0f;
+		state.wheelList = list;
+		state.wheel += delta.y;
+		return true;
+	}
+
+	glm::vec2 mouse_position() {
+		return state.mousePosition;
 	}
 
 	// ...
 
+	static bool has_texture(const TextureHandle &tex) {
+		return tex.handle || tex.id;
+	}
+
+	static bool same_texture(const TextureHandle &a, const TextureHandle &b) {
+		return a.id ? a.id == b.id : (!b.id && a.handle == b.handle);
+	}
+
+	static bool same_rect(const Rect &a, const Rect &b) {
+		return a.pos == b.pos && a.size == b.size;
+	}
+
+	// an empty clip is no clip at all
+	static bool covers(const Rect &clip, const Rect &r) {
+		if (clip.size.x <= 0.0f && clip.size.y <= 0.0f)
+			return true;
+		return r.left() >= clip.left() && r.right() <= clip.right() && r.top() >= clip.top() && r.bottom() <= clip.bottom();
+	}
+
+	static void add_hit(uint64_t id) {
+		Rect r = state.viewportStack.back().intersect(state.clipStack.back());
+		if (r.size.x > 0.0f && r.size.y > 0.0f)
+			state.hitItems.push_back({ r, id });
+	}
+
+	// the viewport takes input as widget id, true when it was under the mouse in the last frame
+	static bool interact(uint64_t id) {
+		add_hit(id);
+		state.lastId = id;
+		return id == state.hotId;
+	}
+
+	// uv is normalized, quads extend the last command unless the clip or texture differ
+	static void add_quad(Rect r, Rect uv, const glm::vec4 &color, const TextureHandle &tex) {
+		const Rect &clip = state.clipStack.back();
+		Rect visible = r.intersect(clip);
+		if (visible.size.x <= 0.0f || visible.size.y <= 0.0f)
+			return;
+		bool inside = same_rect(visible, r);
+
+		Rect cmdClip = clip;
+		if (state.clipMode == ClipMode::cpu) {
+			if (!inside) {
+				// the uvs shrink by the same fractions as the quad
+				glm::vec2 scale = uv.size / r.size;
+				uv = { uv.pos + (visible.pos - r.pos) * scale, visible.size * scale };
+				r = visible;
+			}
+			cmdClip = Rect();
+		}
+
+		DrawList &list = state.drawList;
+		bool textured = has_texture(tex);
+		DrawCommand *cmd = list.commands.empty() ? nullptr : &list.commands.back();
+		// quads the clip doesn't cut draw the same under any clip that contains them
+		bool sameClip = cmd && (same_rect(cmd->clip, cmdClip) || (inside && covers(cmd->clip, r)));
+		bool join = sameClip && (!textured || !has_texture(cmd->texture) || same_texture(cmd->texture, tex));
+		if (!join) {
+			list.commands.push_back({ textured ? tex : TextureHandle{ 0 }, cmdClip, (uint32_t)list.indices.size(), 0 });
+			cmd = &list.commands.back();
+		}
+		else if (textured && !has_texture(cmd->texture)) {
+			// everything so far was solid, which draws the same with any texture bound
+			cmd->texture = tex;
+		}
+		if (!textured)
+			uv = { { untextured_uv, untextured_uv }, { 0.0f, 0.0f } };
+
+		uint32_t base = (uint32_t)list.vertices.size();
+		list.vertices.push_back({ { r.left(),  r.top(),    0.0f }, { uv.left(),  uv.top() },    color });
+		list.vertices.push_back({ { r.right(), r.top(),    0.0f }, { uv.right(), uv.top() },    color });
+		list.vertices.push_back({ { r.left(),  r.bottom(), 0.0f }, { uv.left(),  uv.bottom() }, color });
+		list.vertices.push_back({ { r.right(), r.bottom(), 0.0f }, { uv.right(), uv.bottom() }, color });
+		const uint32_t quad[6] = { 0, 1, 2, 1, 3, 2 };
+		for (uint32_t i : quad)
+			list.indices.push_back(base + i);
+		cmd->indexCount += 6;
+	}
+
+	static void add_rect(Rect r, const glm::vec4 &color) {
+		add_quad(r, Rect(), color, { 0 });
+	}
+
 	const Style& get_style() {
 		// TODO get best matching style
 		// for now, will only match against top of the stack, later support dialog.button and maybe dialog>button etc...
-		const auto it = state.styles.find(state.styleStack.top());
-		if (it != state.styles.end()) {
-			return it->second;
+		const auto &entry = state.styles[state.styleStack.back()];
+		if (entry.defined) {
+			return entry.style;
 		}
-		return state.styles["default"];
+		return state.styles[default_style].style;
 	}
 
 	void draw_background() {
@@ -75,19 +349,39 @@ namespace ursa { namespace gui {
 			background(bg->color);
 		}
 		else if (const auto bg = std::get_if<Style::Textured>(&style.background)) {
-			// TODO draw texture
-			background(bg->color);
+			// TODO tiling/stretching, for now the texture is stretched over the viewport
+			add_quad(state.viewportStack.back(), Rect(1, 1), bg->color, bg->texture);
 		}
 		else if (const auto bg = std::get_if<Style::Custom>(&style.background)) {
 			bg->render();
 		}
 	}
 
-	void draw_string(std::string str) {
+	void draw_string(std::string_view str) {
 		// TODO color
 		// TODO alignment, i.e. center button texts
-		Rect r = state.viewportStack.top();
-		draw_text(state.atlas, state.defaultFontIndex, r.pos.x, r.pos.y, str.c_str());
+		Rect r = state.viewportStack.back();
+		const glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f };
+		const auto &fontInfo = state.atlas->fontInfo(state.defaultFontIndex);
+		float x = r.pos.x;
+		float y = r.pos.y + fontInfo.ascent;
+
+		int page = -1;
+		TextureHandle tex = { 0 };
+		int prev = -1;
+		utf8::for_each(str.data(), str.size(), [&](uint32_t codepoint) {
+			if (prev >= 0)
+				x += state.atlas->kerning(state.defaultFontIndex, prev, (int)codepoint);
+			prev = (int)codepoint;
+			auto info = state.atlas->glyphInfo(state.defaultFontIndex, (int)codepoint);
+			if (info.page != page) {
+				page = info.page;
+				tex = state.atlas->tex(page);
+			}
+			Rect uv = { info.crop.pos / tex.size(), info.crop.size / tex.size() };
+			add_quad(info.bounds.offset(x, y), uv, color, tex);
+			x += info.xadvance;
+		});
 	}
 
 	// ...
@@ -95,18 +389,44 @@ namespace ursa { namespace gui {
 	void frame_begin()
 	{
 		nextId = 0;
+		uint64_t list;
+		hit_test(state.mousePosition, &state.hotId, &list);
+		state.lastId = no_widget;
 		assert(state.viewportStack.empty());
 		assert(state.styleStack.empty());
-		state.viewportStack.push(screenrect());
+		assert(state.clipStack.empty());
+		state.viewportStack.push_back(screenrect());
+		state.clipStack.push_back(screenrect());
+		state.drawList.vertices.clear();
+		state.drawList.indices.clear();
+		state.drawList.commands.clear();
 	}
 
-	void frame_end() {
-		state.viewportStack.pop();
+	void frame_end(bool draw) {
+		state.viewportStack.pop_back();
+		state.clipStack.pop_back();
 		assert(state.styleStack.empty());
 		assert(state.viewportStack.empty());
+		assert(state.clipStack.empty());
+		assert(state.listStack.empty());
 
-		// clicked state only persist until end of the frame
+		build_grid();
+		// clicked state and unused wheel steps only persist until end of the frame
 		state.clicked = false;
+		state.wheel = 0.0f;
+		state.wheelList = no_widget;
+
+		if (draw)
+			render(state.drawList);
+	}
+
+	const DrawList &draw_list() {
+		return state.drawList;
+	}
+
+	void render(const DrawList &list) {
+		draw_indexed(list.vertices.data(), (int)list.vertices.size(), list.indices.data(), (int)list.indices.size(),
+			list.commands.data(), (int)list.commands.size());
 	}
 
 	// TODO ??? x&y size (in % or px), and x&y position (in % or px)
@@ -115,10 +435,17 @@ namespace ursa { namespace gui {
 
 	// TODO RAII guard for panel_begin + panel_end ?
 
+	// makes r the viewport until panel_end
+	static void push_panel(Rect r, StyleId style) {
+		state.viewportStack.push_back(r);
+		state.styleStack.push_back(style);
+		state.clipStack.push_back(r.intersect(state.clipStack.back()));
+	}
+
 	// slice away a portion of the current viewport for the child widget
-	void panel_begin(PanelEdge edge, float size_px, std::string styleName) {
-		Rect current = state.viewportStack.top();
-		state.viewportStack.pop();
+	void panel_begin(PanelEdge edge, float size_px, StyleId style) {
+		Rect current = state.viewportStack.back();
+		state.viewportStack.pop_back();
 
 		Rect parent, child;
 
@@ -137,63 +464,68 @@ namespace ursa { namespace gui {
 				break;
 		}
 
-		state.viewportStack.push(parent);
-		state.viewportStack.push(child);
-		state.styleStack.push(styleName);
+		state.viewportStack.push_back(parent);
+		push_panel(child, style);
 	}
 
-	void panel_begin_by_percent(PanelEdge edge, float size_percent, std::string styleName) {
+	void panel_begin(PanelEdge edge, float size_px, std::string_view styleName) {
+		panel_begin(edge, size_px, state.intern(styleName));
+	}
+
+	void panel_begin_by_percent(PanelEdge edge, float size_percent, StyleId style) {
 		switch (edge) {
 			case PanelEdge::left:
 			case PanelEdge::right:
-				panel_begin(edge, state.viewportStack.top().size.x * size_percent, styleName);
+				panel_begin(edge, state.viewportStack.back().size.x * size_percent, style);
 				break;
 			case PanelEdge::top:
 			case PanelEdge::bottom:
-				panel_begin(edge,state.viewportStack.top().size.y * size_percent, styleName);
+				panel_begin(edge,state.viewportStack.back().size.y * size_percent, style);
 				break;
 		}
 	}
 
+	void panel_begin_by_percent(PanelEdge edge, float size_percent, std::string_view styleName) {
+		panel_begin_by_percent(edge, size_percent, state.intern(styleName));
+	}
+
 	void panel_end() {
-		state.styleStack.pop();
-		state.viewportStack.pop();
+		state.clipStack.pop_back();
+		state.styleStack.pop_back();
+		state.viewportStack.pop_back();
 	}
 
 	void padding(float px) {
-		Rect inner = state.viewportStack.top().expand(-px);
-		state.viewportStack.pop();
-		state.viewportStack.push(inner);
+		state.viewportStack.back() = state.viewportStack.back().expand(-px);
 	}
 
 	void space(float px) {
-		Rect bottom = std::get<1>(state.viewportStack.top().splitY(px));
-		state.viewportStack.pop();
-		state.viewportStack.push(bottom);
+		state.viewportStack.back() = std::get<1>(state.viewportStack.back().splitY(px));
 	}
 
 	void background(const glm::vec4 &color) {
-		draw_rect(state.viewportStack.top(), color);
+		add_rect(state.viewportStack.back(), color);
 	}
 
 	void border(const glm::vec4 &color, float width) {
-		Rect r = state.viewportStack.top();
+		Rect r = state.viewportStack.back();
 
-		draw_rect({ r.left(), r.top(), r.size.x, width }, color);
-		draw_rect({ r.left(), r.bottom()-width, r.size.x, width }, color);
+		add_rect({ r.left(), r.top(), r.size.x, width }, color);
+		add_rect({ r.left(), r.bottom()-width, r.size.x, width }, color);
 
-		draw_rect({ r.left(), r.top()+width, width, r.size.y - width*2 }, color);
-		draw_rect({ r.right()-width, r.top()+width, width, r.size.y - width*2 }, color);
+		add_rect({ r.left(), r.top()+width, width, r.size.y - width*2 }, color);
+		add_rect({ r.right()-width, r.top()+width, width, r.size.y - width*2 }, color);
 	}
 
 
-	bool mouseover() { return state.viewportStack.top().contains(state.mousePosition); }
+	bool mouseover() { return state.lastId != no_widget && state.lastId == state.hotId; }
 
 	bool clicked() { return state.clicked && mouseover(); }
 
-	bool button(std::string str) {
-		int id = nextId++;
-		panel_begin(PanelEdge::top, 32, "button");
+	bool button(std::string_view str) {
+		uint64_t id = nextId++;
+		panel_begin(PanelEdge::top, 32, state.buttonStyle);
+		interact(id);
 
 		bool pressed = false;
 		if (clicked())
@@ -209,32 +541,249 @@ namespace ursa { namespace gui {
 		return pressed;
 	}
 
-	void text(std::string str) {
-		panel_begin(PanelEdge::top, 32, "text");
+	void text(std::string_view str) {
+		panel_begin(PanelEdge::top, 32, state.textStyle);
 		draw_string(str);
 		panel_end();
 	}
 
 	void input() {}
-	void checkbox(std::string label, bool *var) {
-		int id = nextId++;
-		panel_begin(PanelEdge::top, 32, "checkbox");
+	void checkbox(std::string_view label, bool *var) {
+		uint64_t id = nextId++;
+		panel_begin(PanelEdge::top, 32, state.checkboxStyle);
+		interact(id);
 
 		if (clicked())
 			*var = !*var;
 
 		draw_background();
-		panel_begin(PanelEdge::left, 32, *var ? "checkbox_true" : "checkbox_false");
+		panel_begin(PanelEdge::left, 32, *var ? state.checkboxTrueStyle : state.checkboxFalseStyle);
 		draw_background();
 		panel_end();
 		draw_string(label);
 		panel_end();
 	}
-	void radiobutton(std::string label, bool *var) {}
+	void radiobutton(std::string_view label, int value, int *var) {}
 	void progress() {}
 	void slider() {}
-	void listbox() {}
 	void combobox() {}
 
+	static ListState &get_list(std::string_view name) {
+		auto it = state.lists.find(name);
+		if (it == state.lists.end()) {
+			it = state.lists.emplace(std::string(name), ListState()).first;
+			it->second.serial = state.lists.size();
+		}
+		return it->second;
+	}
+
+	static void begin_list(ListState &list, size_t rowCount, float rowHeight, int columns) {
+		if (list.heights.size() != rowCount || list.rowHeight != rowHeight) {
+			if (rowCount > list.heights.size() && list.rowHeight == rowHeight) {
+				// appended rows keep the heights of the rows before them
+				while (list.heights.size() < rowCount)
+					list.heights.push_back(rowHeight);
+			}
+			else {
+				list.heights.assign(rowCount, rowHeight);
+			}
+			list.rowHeight = rowHeight;
+		}
+		list.columns = columns;
+
+		// the list takes the rest of the viewport
+		panel_begin(PanelEdge::top, state.viewportStack.back().size.y, state.listStyle);
+		list.bounds = state.viewportStack.back();
+		uint64_t id = make_id(list_bit, list.serial, 0);
+		add_hit(id);
+		draw_background();
+
+		if (state.wheelList == id) {
+			list.scroll -= state.wheel * rowHeight * 3.0f;
+			state.wheel = 0.0f;
+			state.wheelList = no_widget;
+		}
+		float bottom = std::max(0.0f, (float)list.heights.total() - list.bounds.size.y);
+		list.scroll = std::max(0.0f, std::min(list.scroll, bottom));
+
+		list.next = list.heights.find(list.scroll);
+		list.nextTop = list.bounds.top() + (float)list.heights.sum(list.next) - list.scroll;
+		state.listStack.push_back(&list);
+	}
+
+	static bool row_begin(ListState &list) {
+		if (list.next >= list.heights.size() || list.nextTop >= list.bounds.bottom())
+			return false;
+		list.row = list.next++;
+		float height = list.heights.get(list.row);
+		list.rowRect = { list.bounds.left(), list.nextTop, list.bounds.size.x, height };
+		list.nextTop += height;
+		list.column = 0;
+		push_panel(list.rowRect, state.styleStack.back());
+		return true;
+	}
+
+	static void end_list() {
+		ListState &list = *state.listStack.back();
+		state.listStack.pop_back();
+
+		// TODO scrollbar style, dragging the thumb
+		float total = (float)list.heights.total();
+		if (total > list.bounds.size.y) {
+			float height = std::max(8.0f, list.bounds.size.y * list.bounds.size.y / total);
+			float top = list.bounds.top() + (list.bounds.size.y - height) * list.scroll / (total - list.bounds.size.y);
+			add_rect({ list.bounds.right() - 4.0f, top, 4.0f, height }, { 1.0f, 1.0f, 1.0f, 0.3f });
+		}
+		panel_end();
+	}
+
+	void list_begin(std::string_view name, size_t rowCount, float rowHeight) {
+		begin_list(get_list(name), rowCount, rowHeight, 1);
+	}
+
+	bool listrow_begin(size_t *row) {
+		ListState &list = *state.listStack.back();
+		if (!row_begin(list))
+			return false;
+		interact(make_id(row_bit, list.serial, list.row));
+		*row = list.row;
+		return true;
+	}
+
+	void listrow_height(float height) {
+		ListState &list = *state.listStack.back();
+		float old = list.heights.get(list.row);
+		if (old == height)
+			return;
+		list.heights.set(list.row, height);
+		list.nextTop += height - old;
+	}
+
+	void listrow_end() {
+		panel_end();
+	}
+
+	void list_end() {
+		end_list();
+	}
+
+	bool listbox(std::string_view name, size_t count, const std::function<std::string_view(size_t)> &item, size_t *selected) {
+		bool changed = false;
+		list_begin(name, count);
+		size_t row;
+		while (listrow_begin(&row)) {
+			if (clicked() && *selected != row) {
+				*selected = row;
+				changed = true;
+			}
+			// TODO selection and hover styles
+			if (row == *selected)
+				background({ 1.0f, 1.0f, 1.0f, 0.3f });
+			else if (mouseover())
+				background({ 1.0f, 1.0f, 1.0f, 0.1f });
+			draw_string(item(row));
+			listrow_end();
+		}
+		list_end();
+		return changed;
+	}
+
+	void table_begin(std::string_view name, size_t rowCount, int columns, float rowHeight) {
+		begin_list(get_list(name), rowCount, rowHeight, std::max(1, columns));
+	}
+
+	bool tablerow_begin(size_t *row) {
+		return listrow_begin(row);
+	}
+
+	void tablerow_end() {
+		listrow_end();
+	}
+
+	void tablecell_begin() {
+		ListState &list = *state.listStack.back();
+		// TODO column widths
+		float width = list.rowRect.size.x / list.columns;
+		push_panel({ list.rowRect.left() + width * list.column, list.rowRect.top(), width, list.rowRect.size.y }, state.styleStack.back());
+		list.column++;
+	}
+
+	void tablecell_end() {
+		panel_end();
+	}
+
+	void table_end() {
+		end_list();
+	}
+
+	void tree_begin(std::string_view name, const int depths[], size_t count, float rowHeight) {
+		ListState &tree = get_list(name);
+		// the array may be rebuilt at a new address every frame, only the count tells that nodes changed
+		tree.depths = depths;
+		if (tree.nodeCount != count) {
+			tree.nodeCount = count;
+			tree.expanded.resize(count, false);
+			tree.dirty = true;
+		}
+		if (tree.dirty) {
+			// walk the nodes once, jumping over the children of collapsed nodes
+			tree.visible.clear();
+			for (size_t i = 0; i < count;) {
+				tree.visible.push_back((uint32_t)i);
+				size_t next = i + 1;
+				if (!tree.expanded[i])
+					while (next < count && depths[next] > depths[i])
+						next++;
+				i = next;
+			}
+			// rows are different nodes now, measured heights no longer apply
+			tree.heights.assign(tree.visible.size(), rowHeight);
+			tree.dirty = false;
+		}
+		begin_list(tree, tree.visible.size(), rowHeight, 1);
+	}
+
+	void tree_invalidate(std::string_view name) {
+		get_list(name).dirty = true;
+	}
+
+	bool treenode_begin(size_t *node) {
+		ListState &tree = *state.listStack.back();
+		if (!row_begin(tree))
+			return false;
+		size_t n = tree.visible[tree.row];
+		// keyed by node rather than row, so toggling doesn't move the hover to another node
+		uint64_t id = make_id(row_bit, tree.serial, n);
+		add_hit(id);
+
+		const float indent = 16.0f;
+		Rect r = tree.rowRect;
+		float x = r.left() + indent * tree.depths[n];
+		if (n + 1 < tree.nodeCount && tree.depths[n + 1] > tree.depths[n]) {
+			push_panel({ x, r.top(), indent, r.size.y }, state.styleStack.back());
+			interact(make_id(toggle_bit, tree.serial, n));
+			if (clicked()) {
+				tree.expanded[n] = !tree.expanded[n];
+				// the visible nodes are collected again next frame, this frame keeps drawing the old ones
+				tree.dirty = true;
+			}
+			draw_string(tree.expanded[n] ? "-" : "+");
+			panel_end();
+		}
+		push_panel({ x + indent, r.top(), std::max(0.0f, r.right() - x - indent), r.size.y }, state.styleStack.back());
+		state.lastId = id;
+		*node = n;
+		return true;
+	}
+
+	void treenode_end() {
+		panel_end();
+		panel_end();
+	}
+
+	void tree_end() {
+		end_list();
+	}
+
 }
 }
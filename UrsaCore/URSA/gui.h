@@ -1,7 +1,10 @@
 #pragma once
 
-#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 #include <glm/glm.hpp>
 
@@ -39,25 +42,56 @@ namespace ursa { namespace gui {
 
 	// TODO think about widget state to support animated widgets
 
+	// styles live in a flat table, intern a name once and pass the id around instead of strings
+	// ids of styles that were never set fall back to the default style
+	using StyleId = uint32_t;
+	const StyleId default_style = 0;
+	StyleId style_id(std::string_view name);
+
 	void set_default_font(FontAtlas::object_ref atlas, int fontIndex);
-	void set_style(std::string name, const Style &style);
+	void set_style(StyleId id, const Style &style);
+	void set_style(std::string_view name, const Style &style);
 
 	void handle_mousedown(glm::vec2 pos);
 	void handle_mouseup(glm::vec2 pos);
 	void handle_mousemove(glm::vec2 pos);
-	void handle_mousewheel(glm::vec2 pos);
+	// where the last mouse event put the cursor
+	glm::vec2 mouse_position();
+	// delta in wheel steps as SDL reports them, true when a list under the mouse takes the scroll
+	bool handle_mousewheel(glm::vec2 delta);
 	void handle_keydown();
 
 	// ...
 
+	// hover and clicks resolve against the widgets of the last frame through a grid over the screen, topmost first
+	// both ask about the last widget or row that takes input
 	bool clicked();
 	bool mouseover();
 
 	// ...
 
+	// everything a frame draws in painting order, the commands join quads that share a clip and texture
+	// solid quads carry untextured_uv and join whatever texture the command uses
+	struct DrawList {
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		std::vector<DrawCommand> commands;
+	};
+
+	// panels clip what is drawn inside them, content entirely outside the clip is dropped when it is added
+	// scissor clipping only starts a new command for quads that cross the edge of their panel
+	// cpu clipping cuts those quads down instead, so clipping never splits a batch
+	enum class ClipMode { scissor, cpu };
+	void set_clip_mode(ClipMode mode);
+
 	// TODO specify rendertarget, viewport, whatever
 	void frame_begin();
-	void frame_end();
+	// renders the frame's draw list, pass false to render draw_list() some other way
+	void frame_end(bool draw = true);
+
+	// valid until the next frame_begin
+	const DrawList &draw_list();
+	void render(const DrawList &list);
 
 	// TODO name this thing overlay_begin instead?
 	void dialog_begin();
@@ -66,8 +100,10 @@ namespace ursa { namespace gui {
 	// panels are containers attached to one of the four edges
 	enum class PanelEdge { left, top, right, bottom };
 
-	void panel_begin(PanelEdge edge, float size_px, std::string styleName="");
-	void panel_begin_by_percent(PanelEdge edge, float size_percent, std::string styleName="");
+	void panel_begin(PanelEdge edge, float size_px, StyleId style = default_style);
+	void panel_begin(PanelEdge edge, float size_px, std::string_view styleName);
+	void panel_begin_by_percent(PanelEdge edge, float size_percent, StyleId style = default_style);
+	void panel_begin_by_percent(PanelEdge edge, float size_percent, std::string_view styleName);
 	void panel_end();
 
 	void padding(float px);
@@ -76,26 +112,46 @@ namespace ursa { namespace gui {
 	void background(const glm::vec4 &color);
 	void border(const glm::vec4 &color, float width);
 
-	bool button(std::string str);
-	void text(std::string str);
+	// labels are only read during the call, nothing is copied
+	bool button(std::string_view str);
+	void text(std::string_view str);
 	void input();
-	void checkbox(std::string label, bool *var);
-	void radiobutton(std::string label, int value, int *var);
+	void checkbox(std::string_view label, bool *var);
+	void radiobutton(std::string_view label, int value, int *var);
 	void progress();
 	void slider();
-	void listbox();
 	void combobox();
 
-	void table_begin();
-	void table_end();
-	void tablerow_begin();
+	// lists, tables and trees fill the rest of the viewport and keep their scroll position and row heights by name
+	// only the rows inside the view are visited, row tops come from a prefix sum so 100k rows cost as much as 10
+	void list_begin(std::string_view name, size_t rowCount, float rowHeight = 32.0f);
+	// moves on to the next visible row and makes it the viewport, false once the visible rows are done
+	bool listrow_begin(size_t *row);
+	// rows start out rowHeight tall, this corrects the height of the current row and moves the rows after it
+	void listrow_height(float height);
+	void listrow_end();
+	void list_end();
+
+	// a list of text items, true when the selection changed
+	bool listbox(std::string_view name, size_t count, const std::function<std::string_view(size_t)> &item, size_t *selected);
+
+	// a list whose rows are split into equally wide cells
+	void table_begin(std::string_view name, size_t rowCount, int columns, float rowHeight = 32.0f);
+	bool tablerow_begin(size_t *row);
 	void tablerow_end();
+	// makes the next cell of the row the viewport
 	void tablecell_begin();
 	void tablecell_end();
+	void table_end();
 
-	void list_begin();
-	void list_end();
-
-	void tree_begin();
+	// nodes are given by their depths in depth first order, children follow their parent one level deeper
+	// nodes start collapsed and keep their expanded state by index, the visible rows are only collected again after
+	// a toggle, a change of count or tree_invalidate; depths may move between frames
+	void tree_begin(std::string_view name, const int depths[], size_t count, float rowHeight = 32.0f);
+	// the depths changed without the count changing, call before tree_begin
+	void tree_invalidate(std::string_view name);
+	// the next visible node, indented by its depth behind a toggle when it has children
+	bool treenode_begin(size_t *node);
+	void treenode_end();
 	void tree_end();
 }}
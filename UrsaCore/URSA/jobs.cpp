@@ -0,0 +1,114 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ursa { namespace jobs {
+
+	struct Pool {
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> queue;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		bool stopping{ false };
+
+		void start() {
+			// leave one core for the render thread
+			int count = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+			for (int i = 0; i < count; i++) {
+				workers.emplace_back([this]() { work(); });
+			}
+		}
+
+		void work() {
+			for (;;) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wakeup.wait(lock, [this]() { return stopping || !queue.empty(); });
+					if (stopping)
+						return;
+					job = std::move(queue.front());
+					queue.pop_front();
+				}
+				job();
+			}
+		}
+
+		void stop() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+				queue.clear();
+			}
+			wakeup.notify_all();
+			for (auto &t : workers)
+				t.join();
+			workers.clear();
+			stopping = false;
+		}
+
+		~Pool() { stop(); }
+	};
+
+	static Pool pool;
+
+	void submit(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			if (pool.workers.empty())
+				pool.start();
+			pool.queue.push_back(std::move(job));
+		}
+		pool.wakeup.notify_one();
+	}
+
+	void parallel_for(int count, const std::function<void(int)> &fn) {
+		if (count <= 0)
+			return;
+
+		struct Batch {
+			std::atomic<int> next{ 0 };
+			std::atomic<int> done{ 0 };
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		auto batch = std::make_shared<Batch>();
+
+		// helpers that only get to run after everything is done never touch fn
+		auto run = [batch, count, &fn]() {
+			int i, ran = 0;
+			while ((i = batch->next++) < count) {
+				fn(i);
+				ran++;
+			}
+			if (ran && batch->done.fetch_add(ran) + ran == count) {
+				std::lock_guard<std::mutex> lock(batch->mutex);
+				batch->finished.notify_all();
+			}
+		};
+
+		int helpers = std::min(count - 1, std::max(1, (int)std::thread::hardware_concurrency() - 1));
+		for (int i = 0; i < helpers; i++)
+			submit(run);
+		run();
+
+		std::unique_lock<std::mutex> lock(batch->mutex);
+		batch->finished.wait(lock, [&]() { return batch->done == count; });
+	}
+
+	int worker_count() {
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		return (int)pool.workers.size();
+	}
+
+	void shutdown() {
+		pool.stop();
+	}
+}}
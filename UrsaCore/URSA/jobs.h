@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+
+// shared worker pool for background work such as image decoding
+namespace ursa { namespace jobs {
+
+	// queue a job, the pool is started lazily on first use
+	void submit(std::function<void()> job);
+
+	// calls fn for every index in [0, count) spread over the workers and the calling thread, returns when all are done
+	void parallel_for(int count, const std::function<void(int)> &fn);
+
+	int worker_count();
+
+	// joins the workers, jobs that haven't started yet are dropped
+	void shutdown();
+}}
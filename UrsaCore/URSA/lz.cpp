@@ -0,0 +1,133 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <cstring>
+
+// The stream is a list of sequences, LZ4 style:
+//   token (literal count << 4 | match length - 4), extra literal count bytes, literals,
+//   2-byte little endian match offset, extra match length bytes
+// counts of 15 continue in extra bytes, 255 meaning "add and keep reading"
+// the final sequence only carries literals
+
+namespace ursa { namespace lz {
+
+	static const size_t minMatch = 4;
+	static const size_t maxOffset = 65535;
+	static const int hashBits = 14;
+
+	static uint32_t read32(const uint8_t *p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	static void put_length(std::vector<uint8_t> &out, size_t len) {
+		while (len >= 255) {
+			out.push_back(255);
+			len -= 255;
+		}
+		out.push_back((uint8_t)len);
+	}
+
+	static void put_sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t litLen, size_t offset, size_t matchLen) {
+		size_t m = matchLen ? matchLen - minMatch : 0;
+		out.push_back((uint8_t)((std::min<size_t>(litLen, 15) << 4) | std::min<size_t>(m, 15)));
+		if (litLen >= 15)
+			put_length(out, litLen - 15);
+		out.insert(out.end(), literals, literals + litLen);
+		if (!matchLen)
+			return;
+		out.push_back((uint8_t)(offset & 0xff));
+		out.push_back((uint8_t)(offset >> 8));
+		if (m >= 15)
+			put_length(out, m - 15);
+	}
+
+	std::vector<uint8_t> compress(const void *data, size_t size) {
+		const uint8_t *in = static_cast<const uint8_t*>(data);
+		std::vector<uint8_t> out;
+		out.reserve(size + size / 255 + 16);
+
+		// positions + 1, zero meaning empty
+		std::vector<size_t> table((size_t)1 << hashBits, 0);
+
+		size_t anchor = 0, i = 0;
+		// keep a few trailing bytes as literals so matches never need to check the end of input
+		size_t limit = (size > 12) ? size - 5 : 0;
+		while (i + minMatch <= limit) {
+			uint32_t seq = read32(in + i);
+			uint32_t h = (seq * 2654435761u) >> (32 - hashBits);
+			size_t candidate = table[h];
+			table[h] = i + 1;
+
+			if (candidate && i - (candidate - 1) <= maxOffset && read32(in + candidate - 1) == seq) {
+				size_t ref = candidate - 1;
+				size_t len = minMatch;
+				while (i + len < limit && in[ref + len] == in[i + len])
+					len++;
+				put_sequence(out, in + anchor, i - anchor, i - ref, len);
+				i += len;
+				anchor = i;
+			} else {
+				i++;
+			}
+		}
+		put_sequence(out, in + anchor, size - anchor, 0, 0);
+		return out;
+	}
+
+	static bool get_length(const uint8_t *&ip, const uint8_t *iend, size_t &len) {
+		uint8_t b;
+		do {
+			if (ip >= iend)
+				return false;
+			b = *ip++;
+			len += b;
+		} while (b == 255);
+		return true;
+	}
+
+	bool decompress(const void *src, size_t srcSize, void *dst, size_t dstSize) {
+		const uint8_t *ip = static_cast<const uint8_t*>(src);
+		const uint8_t *iend = ip + srcSize;
+		uint8_t *op = static_cast<uint8_t*>(dst);
+		uint8_t *const ostart = op;
+		uint8_t *const oend = op + dstSize;
+
+		while (ip < iend) {
+			uint8_t token = *ip++;
+
+			size_t lit = token >> 4;
+			if (lit == 15 && !get_length(ip, iend, lit))
+				return false;
+			if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+				return false;
+			memcpy(op, ip, lit);
+			op += lit;
+			ip += lit;
+
+			if (ip == iend)
+				break;
+
+			if (iend - ip < 2)
+				return false;
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > (size_t)(op - ostart))
+				return false;
+
+			size_t len = token & 15;
+			if (len == 15 && !get_length(ip, iend, len))
+				return false;
+			len += minMatch;
+			if (len > (size_t)(oend - op))
+				return false;
+
+			// byte by byte, the match may overlap the bytes it produces
+			const uint8_t *ref = op - offset;
+			for (size_t i = 0; i < len; i++)
+				*op++ = *ref++;
+		}
+		return op == oend;
+	}
+}}
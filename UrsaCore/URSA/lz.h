@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// small LZ77 byte codec for cache files and asset packs, favours decompression speed over ratio
+namespace ursa { namespace lz {
+
+	std::vector<uint8_t> compress(const void *data, size_t size);
+
+	// dst must hold exactly the original size, returns false on corrupt input
+	bool decompress(const void *src, size_t srcSize, void *dst, size_t dstSize);
+}}
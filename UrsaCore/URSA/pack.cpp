@@ -0,0 +1,240 @@
+#include "pack.h"
+#include "file.h"
+#include "lz.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace ursa { namespace pack {
+
+	namespace {
+		const char packMagic[4] = { 'U', 'P', 'K', '1' };
+		const uint32_t packVersion = 1;
+		const size_t blobAlignment = 16;
+
+		const uint32_t entryCompressed = 1;
+
+		struct Header {
+			char magic[4];
+			uint32_t version;
+			uint32_t entryCount;
+			uint32_t flags;
+			uint64_t namesOffset;
+			uint64_t namesSize;
+		};
+
+		struct Entry {
+			uint64_t nameHash;
+			uint32_t nameOffset;
+			uint32_t nameLength;
+			uint64_t offset;
+			uint64_t storedSize;
+			uint64_t size;
+			uint32_t flags;
+			uint32_t reserved;
+		};
+
+		static_assert(sizeof(Header) == 32, "pack header layout");
+		static_assert(sizeof(Entry) == 48, "pack entry layout");
+
+		// names are case folded on every platform so archives built on Windows work elsewhere
+		std::string entry_name(const char *path) {
+			std::string name = normalize_path(path);
+			for (auto &c : name)
+				c = (char)tolower((unsigned char)c);
+			return name;
+		}
+
+		struct Archive {
+			std::shared_ptr<const MappedFile> file;
+			std::string prefix;
+			const Entry *entries = nullptr;
+			uint32_t count = 0;
+			const char *names = nullptr;
+
+			const Entry *find(const std::string &name) const {
+				uint64_t hash = hash_bytes(name.data(), name.size());
+				const Entry *end = entries + count;
+				const Entry *e = std::lower_bound(entries, end, hash, [](const Entry &a, uint64_t h) { return a.nameHash < h; });
+				for (; e != end && e->nameHash == hash; e++) {
+					if (e->nameLength == name.size() && memcmp(names + e->nameOffset, name.data(), name.size()) == 0)
+						return e;
+				}
+				return nullptr;
+			}
+		};
+
+		std::mutex g_mountMutex;
+		std::vector<Archive> g_archives;
+	}
+
+	bool mount(const char *archive, const char *prefix) {
+		auto file = std::make_shared<const MappedFile>(archive);
+		if (!file->valid() || file->size() < sizeof(Header))
+			return false;
+
+		const Header &h = *reinterpret_cast<const Header*>(file->data());
+		if (memcmp(h.magic, packMagic, sizeof(packMagic)) != 0 || h.version != packVersion)
+			return false;
+		size_t tableEnd = sizeof(Header) + (size_t)h.entryCount * sizeof(Entry);
+		if (tableEnd > file->size() || h.namesOffset < tableEnd || h.namesOffset + h.namesSize > file->size())
+			return false;
+
+		Archive a;
+		a.entries = reinterpret_cast<const Entry*>(file->data() + sizeof(Header));
+		a.count = h.entryCount;
+		a.names = reinterpret_cast<const char*>(file->data() + h.namesOffset);
+		for (uint32_t i = 0; i < a.count; i++) {
+			const Entry &e = a.entries[i];
+			if ((uint64_t)e.nameOffset + e.nameLength > h.namesSize || e.offset + e.storedSize > file->size())
+				return false;
+		}
+		a.prefix = entry_name(prefix);
+		a.file = std::move(file);
+
+		std::lock_guard<std::mutex> lock(g_mountMutex);
+		g_archives.push_back(std::move(a));
+		return true;
+	}
+
+	void unmount_all() {
+		std::lock_guard<std::mutex> lock(g_mountMutex);
+		g_archives.clear();
+	}
+
+	Span load(const char *path) {
+		std::string name = entry_name(path);
+		{
+			std::lock_guard<std::mutex> lock(g_mountMutex);
+			for (auto a = g_archives.rbegin(); a != g_archives.rend(); ++a) {
+				std::string rel = name;
+				if (!a->prefix.empty()) {
+					const std::string &prefix = a->prefix;
+					if (name.compare(0, prefix.size(), prefix) != 0 || name.size() <= prefix.size() || name[prefix.size()] != '/')
+						continue;
+					rel = name.substr(prefix.size() + 1);
+				}
+				const Entry *e = a->find(rel);
+				if (!e)
+					continue;
+
+				const uint8_t *blob = a->file->data() + e->offset;
+				if (!(e->flags & entryCompressed))
+					return { a->file, blob, (size_t)e->size };
+
+				auto unpacked = std::make_shared<std::vector<uint8_t>>((size_t)e->size);
+				if (!lz::decompress(blob, (size_t)e->storedSize, unpacked->data(), unpacked->size()))
+					return {};
+				return { unpacked, unpacked->data(), unpacked->size() };
+			}
+		}
+
+		auto file = file_mapped(path);
+		if (!file->valid())
+			return {};
+		return { file, file->data(), file->size() };
+	}
+
+	bool build(const char *directory, const char *archive, bool compress, std::string *error) {
+		namespace fs = std::filesystem;
+
+		struct Source {
+			std::string name;
+			uint64_t hash;
+			MappedFile file;
+			std::vector<uint8_t> packed;
+			Entry entry;
+		};
+		std::vector<Source> sources;
+
+		std::error_code ec;
+		for (fs::recursive_directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec)) {
+			if (!it->is_regular_file())
+				continue;
+			Source s;
+			s.name = entry_name(it->path().lexically_relative(directory).generic_string().c_str());
+			s.hash = hash_bytes(s.name.data(), s.name.size());
+			s.file = MappedFile(it->path().string().c_str());
+			if (!s.file.valid() && fs::file_size(it->path(), ec) != 0) {
+				if (error)
+					*error = "can't read " + it->path().string();
+				return false;
+			}
+			sources.push_back(std::move(s));
+		}
+		if (ec) {
+			if (error)
+				*error = "can't list " + std::string(directory) + ": " + ec.message();
+			return false;
+		}
+
+		std::sort(sources.begin(), sources.end(), [](const Source &a, const Source &b) {
+			return (a.hash != b.hash) ? (a.hash < b.hash) : (a.name < b.name);
+		});
+
+		std::string names;
+		for (auto &s : sources) {
+			memset(&s.entry, 0, sizeof(s.entry));
+			s.entry.nameHash = s.hash;
+			s.entry.nameOffset = (uint32_t)names.size();
+			s.entry.nameLength = (uint32_t)s.name.size();
+			s.entry.size = s.file.size();
+			names += s.name;
+
+			if (compress && s.file.size() > 64) {
+				s.packed = lz::compress(s.file.data(), s.file.size());
+				// already compressed formats (png, jpg, ogg) barely shrink, keep those directly mappable
+				if (s.packed.size() < s.file.size() - s.file.size() / 8)
+					s.entry.flags |= entryCompressed;
+				else
+					s.packed.clear();
+			}
+		}
+
+		auto align = [](uint64_t offset) { return (offset + blobAlignment - 1) & ~(uint64_t)(blobAlignment - 1); };
+
+		Header h;
+		memcpy(h.magic, packMagic, sizeof(packMagic));
+		h.version = packVersion;
+		h.entryCount = (uint32_t)sources.size();
+		h.flags = 0;
+		h.namesOffset = sizeof(Header) + sources.size() * sizeof(Entry);
+		h.namesSize = names.size();
+
+		uint64_t offset = align(h.namesOffset + h.namesSize);
+		for (auto &s : sources) {
+			s.entry.offset = offset;
+			s.entry.storedSize = (s.entry.flags & entryCompressed) ? s.packed.size() : s.file.size();
+			offset = align(offset + s.entry.storedSize);
+		}
+
+		std::ofstream out(archive, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		for (const auto &s : sources)
+			out.write(reinterpret_cast<const char*>(&s.entry), sizeof(s.entry));
+		out.write(names.data(), names.size());
+
+		const char padding[blobAlignment] = { 0 };
+		uint64_t written = h.namesOffset + h.namesSize;
+		for (const auto &s : sources) {
+			out.write(padding, s.entry.offset - written);
+			if (s.entry.flags & entryCompressed)
+				out.write(reinterpret_cast<const char*>(s.packed.data()), s.packed.size());
+			else
+				out.write(reinterpret_cast<const char*>(s.file.data()), s.file.size());
+			written = s.entry.offset + s.entry.storedSize;
+		}
+
+		if (!out) {
+			if (error)
+				*error = "can't write " + std::string(archive);
+			return false;
+		}
+		return true;
+	}
+}}
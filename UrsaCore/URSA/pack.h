@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// read-only archive holding many assets in a single memory mapped file
+// layout: header, entry table sorted by name hash, names, then the blobs each aligned to 16 bytes
+namespace ursa { namespace pack {
+
+	// bytes of an asset, valid while owner is held
+	// points straight into the archive (or the file mapping) unless the blob had to be decompressed
+	struct Span {
+		std::shared_ptr<const void> owner;
+		const uint8_t *data = nullptr;
+		size_t size = 0;
+
+		bool valid() const { return data != nullptr; }
+	};
+
+	// paths below prefix are looked up in the archive first, later mounts take precedence
+	bool mount(const char *archive, const char *prefix = "");
+	void unmount_all();
+
+	// asset from the mounted archives, falls back to mapping the file from disk
+	Span load(const char *path);
+
+	// packs every file below directory, names are stored relative to it
+	// with compress set blobs are lz compressed where that saves a worthwhile amount of space
+	bool build(const char *directory, const char *archive, bool compress, std::string *error = nullptr);
+}}
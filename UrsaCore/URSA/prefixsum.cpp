@@ -0,0 +1,67 @@
+#include "prefixsum.h"
+
+#include <cassert>
+
+namespace ursa {
+
+	static size_t lowbit(size_t i) {
+		return i & (~i + 1);
+	}
+
+	void PrefixSum::clear() {
+		m_values.clear();
+		m_tree.assign(1, 0.0);
+	}
+
+	void PrefixSum::assign(size_t count, float value) {
+		m_values.assign(count, value);
+		m_tree.assign(count + 1, 0.0);
+		for (size_t i = 1; i <= count; i++) {
+			m_tree[i] += value;
+			size_t parent = i + lowbit(i);
+			if (parent <= count)
+				m_tree[parent] += m_tree[i];
+		}
+	}
+
+	void PrefixSum::push_back(float value) {
+		m_values.push_back(value);
+		size_t i = m_values.size();
+		// the new node covers itself plus the lowbit(i) - 1 values before it
+		m_tree.push_back(value + sum(i - 1) - sum(i - lowbit(i)));
+	}
+
+	void PrefixSum::set(size_t index, float value) {
+		assert(index < m_values.size());
+		double delta = (double)value - m_values[index];
+		m_values[index] = value;
+		for (size_t i = index + 1; i < m_tree.size(); i += lowbit(i))
+			m_tree[i] += delta;
+	}
+
+	double PrefixSum::sum(size_t count) const {
+		assert(count <= m_values.size());
+		double total = 0.0;
+		for (size_t i = count; i > 0; i -= lowbit(i))
+			total += m_tree[i];
+		return total;
+	}
+
+	size_t PrefixSum::find(double offset) const {
+		size_t n = m_values.size();
+		if (!n)
+			return 0;
+		size_t step = 1;
+		while (step * 2 <= n)
+			step *= 2;
+		// descend the tree, pos ends up as the number of values lying entirely before offset
+		size_t pos = 0;
+		for (; step; step /= 2) {
+			if (pos + step <= n && m_tree[pos + step] <= offset) {
+				pos += step;
+				offset -= m_tree[pos];
+			}
+		}
+		return pos < n ? pos : n - 1;
+	}
+}
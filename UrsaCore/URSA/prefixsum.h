@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace ursa {
+
+	// running sums over a growing list of values such as row heights, kept in a Fenwick tree
+	// changing a value, the sum up to an index and finding the index at an offset all take O(log n)
+	class PrefixSum {
+	public:
+		void clear();
+		// count copies of value, built in linear time
+		void assign(size_t count, float value);
+		void push_back(float value);
+		void set(size_t index, float value);
+		float get(size_t index) const { return m_values[index]; }
+		size_t size() const { return m_values.size(); }
+
+		// sum of the first count values
+		double sum(size_t count) const;
+		double total() const { return sum(m_values.size()); }
+		// the index whose range [sum(i), sum(i + 1)) contains offset, clamped to the last index; 0 when empty
+		size_t find(double offset) const;
+
+	private:
+		std::vector<float> m_values;
+		// 1-based, node i covers the lowbit(i) values ending at i; doubles so long lists don't drift
+		std::vector<double> m_tree{ 0.0 };
+	};
+}
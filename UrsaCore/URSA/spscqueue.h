@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace ursa {
+
+	// fixed capacity ring between one producer and one consumer thread, neither side ever locks or waits
+	// the counters only grow, their difference is the number of queued items
+	template<typename T>
+	class SpscQueue {
+	public:
+		// rounded up to a power of two
+		explicit SpscQueue(size_t capacity) {
+			size_t size = 1;
+			while (size < capacity)
+				size *= 2;
+			m_items.resize(size);
+			m_mask = size - 1;
+		}
+
+		// producer side, false when the queue is full
+		bool push(const T &value) {
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (head - m_tail.load(std::memory_order_acquire) == m_items.size())
+				return false;
+			m_items[head & m_mask] = value;
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer side, false when the queue is empty
+		bool pop(T *out) {
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail == m_head.load(std::memory_order_acquire))
+				return false;
+			*out = m_items[tail & m_mask];
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// only a snapshot while the other side is running
+		size_t size() const {
+			return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::vector<T> m_items;
+		size_t m_mask = 0;
+		// on their own cache lines, so the two threads don't take the line from each other on every item
+		alignas(64) std::atomic<size_t> m_head{ 0 };
+		alignas(64) std::atomic<size_t> m_tail{ 0 };
+	};
+}
@@ -0,0 +1,312 @@
+#include "texcompress.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define URSA_BC_SSE2
+#endif
+
+namespace ursa { namespace bc {
+
+	typedef uint8_t Block[16][4];
+
+	size_t block_bytes(Format format) {
+		return (format == Format::BC3) ? 16 : 8;
+	}
+
+	size_t compressed_size(Format format, int width, int height) {
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+	}
+
+	// edge blocks replicate the last row and column
+	static void load_block(const uint8_t *pixels, int width, int height, int channels, int bx, int by, Block &block) {
+		for (int y = 0; y < 4; y++) {
+			int sy = std::min(by * 4 + y, height - 1);
+			for (int x = 0; x < 4; x++) {
+				int sx = std::min(bx * 4 + x, width - 1);
+				const uint8_t *p = pixels + ((size_t)sy * width + sx) * channels;
+				uint8_t *d = block[y * 4 + x];
+				switch (channels) {
+					case 1: d[0] = d[1] = d[2] = p[0]; d[3] = 255; break;
+					case 2: d[0] = d[1] = d[2] = p[0]; d[3] = p[1]; break;
+					case 3: d[0] = p[0]; d[1] = p[1]; d[2] = p[2]; d[3] = 255; break;
+					default: memcpy(d, p, 4); break;
+				}
+			}
+		}
+	}
+
+	static void block_bounds(const Block &block, uint8_t mn[4], uint8_t mx[4]) {
+#ifdef URSA_BC_SSE2
+		const __m128i *p = reinterpret_cast<const __m128i*>(block);
+		__m128i lo = _mm_loadu_si128(p), hi = lo;
+		for (int i = 1; i < 4; i++) {
+			__m128i v = _mm_loadu_si128(p + i);
+			lo = _mm_min_epu8(lo, v);
+			hi = _mm_max_epu8(hi, v);
+		}
+		// fold the four pixels of each register into one
+		lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+		lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+		hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+		hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+		uint32_t a = (uint32_t)_mm_cvtsi128_si32(lo), b = (uint32_t)_mm_cvtsi128_si32(hi);
+		memcpy(mn, &a, 4);
+		memcpy(mx, &b, 4);
+#else
+		for (int c = 0; c < 4; c++) {
+			mn[c] = 255;
+			mx[c] = 0;
+		}
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 4; c++) {
+				mn[c] = std::min(mn[c], block[i][c]);
+				mx[c] = std::max(mx[c], block[i][c]);
+			}
+		}
+#endif
+	}
+
+	static int clamp255(float v) {
+		return std::max(0, std::min(255, (int)(v + 0.5f)));
+	}
+
+	static uint16_t to565(const float c[3]) {
+		int r = clamp255(c[0]), g = clamp255(c[1]), b = clamp255(c[2]);
+		return (uint16_t)((((r * 31 + 127) / 255) << 11) | (((g * 63 + 127) / 255) << 5) | ((b * 31 + 127) / 255));
+	}
+
+	static void from565(uint16_t c, int out[3]) {
+		int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		out[0] = (r << 3) | (r >> 2);
+		out[1] = (g << 2) | (g >> 4);
+		out[2] = (b << 3) | (b >> 2);
+	}
+
+	// picks the nearest of the four palette entries for every pixel, returns the squared error
+	static int color_indices(const Block &block, uint16_t c0, uint16_t c1, uint8_t indices[16]) {
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		int error = 0;
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestDist = 1 << 30;
+			for (int p = 0; p < 4; p++) {
+				int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+				int dist = dr * dr + dg * dg + db * db;
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			indices[i] = (uint8_t)best;
+			error += bestDist;
+		}
+		return error;
+	}
+
+	static void endpoints_bounds(const Block &block, float hi[3], float lo[3]) {
+		uint8_t mn[4], mx[4];
+		block_bounds(block, mn, mx);
+
+		// the box diagonal only fits if the channels correlate, flip red and blue against green otherwise
+		float center[3];
+		for (int c = 0; c < 3; c++)
+			center[c] = (mn[c] + mx[c]) * 0.5f;
+		float rg = 0, bg = 0;
+		for (int i = 0; i < 16; i++) {
+			float g = block[i][1] - center[1];
+			rg += (block[i][0] - center[0]) * g;
+			bg += (block[i][2] - center[2]) * g;
+		}
+
+		for (int c = 0; c < 3; c++) {
+			// inset a little, the extremes are rarely worth an exact palette entry
+			float inset = (mx[c] - mn[c]) / 16.0f;
+			hi[c] = mx[c] - inset;
+			lo[c] = mn[c] + inset;
+		}
+		if (rg < 0)
+			std::swap(hi[0], lo[0]);
+		if (bg < 0)
+			std::swap(hi[2], lo[2]);
+	}
+
+	static void endpoints_pca(const Block &block, float hi[3], float lo[3]) {
+		float mean[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += block[i][c];
+		for (int c = 0; c < 3; c++)
+			mean[c] /= 16.0f;
+
+		float cov[6] = { 0 }; // rr rg rb gg gb bb
+		for (int i = 0; i < 16; i++) {
+			float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+			cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+			cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+		}
+
+		// power iteration for the principal axis
+		float axis[3] = { 1, 1, 1 };
+		for (int iter = 0; iter < 8; iter++) {
+			float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+			float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+			float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+			float m = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+			if (m == 0)
+				break;
+			axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+		}
+
+		float tmin = 1e30f, tmax = -1e30f;
+		for (int i = 0; i < 16; i++) {
+			float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+		float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+		if (len2 > 0) {
+			tmin /= len2;
+			tmax /= len2;
+		}
+		for (int c = 0; c < 3; c++) {
+			hi[c] = mean[c] + axis[c] * tmax;
+			lo[c] = mean[c] + axis[c] * tmin;
+		}
+	}
+
+	// solves for the endpoints that best reproduce the block with the given indices
+	static bool refine_endpoints(const Block &block, const uint8_t indices[16], float hi[3], float lo[3]) {
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0, bb = 0, ab = 0, ax[3] = { 0 }, bx[3] = { 0 };
+		for (int i = 0; i < 16; i++) {
+			float a = weights[indices[i]], b = 1.0f - a;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			for (int c = 0; c < 3; c++) {
+				ax[c] += a * block[i][c];
+				bx[c] += b * block[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::abs(det) < 1e-6f)
+			return false;
+		for (int c = 0; c < 3; c++) {
+			hi[c] = (ax[c] * bb - bx[c] * ab) / det;
+			lo[c] = (bx[c] * aa - ax[c] * ab) / det;
+		}
+		return true;
+	}
+
+	static void encode_color(const Block &block, Quality quality, uint8_t *out) {
+		float hi[3], lo[3];
+		if (quality == Quality::Fast)
+			endpoints_bounds(block, hi, lo);
+		else
+			endpoints_pca(block, hi, lo);
+
+		uint16_t c0 = to565(hi), c1 = to565(lo);
+		uint8_t indices[16];
+		int error = color_indices(block, c0, c1, indices);
+
+		if (quality == Quality::High && error > 0 && refine_endpoints(block, indices, hi, lo)) {
+			uint16_t r0 = to565(hi), r1 = to565(lo);
+			uint8_t refined[16];
+			if (color_indices(block, r0, r1, refined) < error) {
+				c0 = r0;
+				c1 = r1;
+				memcpy(indices, refined, 16);
+			}
+		}
+
+		// c0 > c1 selects the four color mode, equal endpoints are fine with all zero indices
+		if (c0 < c1) {
+			std::swap(c0, c1);
+			for (int i = 0; i < 16; i++)
+				indices[i] ^= 1;
+		}
+		if (c0 == c1)
+			memset(indices, 0, 16);
+
+		uint32_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (uint32_t)indices[i] << (i * 2);
+		out[0] = (uint8_t)(c0 & 0xff);
+		out[1] = (uint8_t)(c0 >> 8);
+		out[2] = (uint8_t)(c1 & 0xff);
+		out[3] = (uint8_t)(c1 >> 8);
+		for (int i = 0; i < 4; i++)
+			out[4 + i] = (uint8_t)(bits >> (i * 8));
+	}
+
+	// BC4 block, also used for the BC3 alpha
+	static void encode_channel(const Block &block, int channel, uint8_t *out) {
+		int mn = 255, mx = 0;
+		for (int i = 0; i < 16; i++) {
+			mn = std::min(mn, (int)block[i][channel]);
+			mx = std::max(mx, (int)block[i][channel]);
+		}
+		memset(out, 0, 8);
+		out[0] = (uint8_t)mx;
+		out[1] = (uint8_t)mn;
+		if (mx == mn)
+			return;
+
+		// eight value mode since out[0] > out[1]
+		int palette[8] = { mx, mn };
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * mx + (i - 1) * mn + 3) / 7;
+
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++) {
+			int v = block[i][channel];
+			int best = 0, bestDist = 256;
+			for (int p = 0; p < 8; p++) {
+				int dist = std::abs(v - palette[p]);
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = p;
+				}
+			}
+			bits |= (uint64_t)best << (i * 3);
+		}
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (uint8_t)(bits >> (i * 8));
+	}
+
+	void compress(const uint8_t *pixels, int width, int height, int channels, Format format, Quality quality, uint8_t *out) {
+		int bw = (width + 3) / 4, bh = (height + 3) / 4;
+		size_t bytes = block_bytes(format);
+
+		jobs::parallel_for(bh, [&](int by) {
+			Block block;
+			for (int bx = 0; bx < bw; bx++) {
+				load_block(pixels, width, height, channels, bx, by, block);
+				uint8_t *dst = out + ((size_t)by * bw + bx) * bytes;
+				switch (format) {
+					case Format::BC1:
+						encode_color(block, quality, dst);
+						break;
+					case Format::BC3:
+						encode_channel(block, 3, dst);
+						encode_color(block, quality, dst + 8);
+						break;
+					case Format::BC4:
+						encode_channel(block, 0, dst);
+						break;
+				}
+			}
+		});
+	}
+}}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU block compression into the S3TC / RGTC formats
+namespace ursa { namespace bc {
+
+	// BC1 is opaque RGB, BC3 is RGB + separate alpha, BC4 keeps a single channel
+	enum class Format { BC1, BC3, BC4 };
+
+	// Fast uses bounding box endpoints, High fits the principal axis and refines the endpoints with least squares
+	enum class Quality { Fast, High };
+
+	size_t block_bytes(Format format);
+	size_t compressed_size(Format format, int width, int height);
+
+	// pixels are tightly packed with 1-4 channels, out needs compressed_size() bytes
+	// block rows are spread over the job workers
+	void compress(const uint8_t *pixels, int width, int height, int channels, Format format, Quality quality, uint8_t *out);
+}}
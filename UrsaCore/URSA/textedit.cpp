@@ -0,0 +1,466 @@
+#include "URSA.h"
+#include "textedit.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace ursa { namespace text {
+
+	static bool is_continuation(char c) {
+		return (c & 0xC0) == 0x80;
+	}
+
+	void Editor::GapBuffer::move_gap(size_t pos) {
+		if (pos < gapStart) {
+			size_t n = gapStart - pos;
+			memmove(&data[gapEnd - n], &data[pos], n);
+			gapStart -= n;
+			gapEnd -= n;
+		} else if (pos > gapStart) {
+			size_t n = pos - gapStart;
+			memmove(&data[gapStart], &data[gapEnd], n);
+			gapStart += n;
+			gapEnd += n;
+		}
+	}
+
+	void Editor::GapBuffer::insert(size_t pos, const char *text, size_t length) {
+		if (gapEnd - gapStart < length) {
+			// the gap grows with the text so long runs of typing don't keep reallocating
+			size_t content = size();
+			size_t gap = std::max(length, content / 2) + 64;
+			std::vector<char> grown(content + gap);
+			copy(0, pos, grown.data());
+			copy(pos, content - pos, grown.data() + pos + gap);
+			data.swap(grown);
+			gapStart = pos;
+			gapEnd = pos + gap;
+		} else {
+			move_gap(pos);
+		}
+		memcpy(&data[gapStart], text, length);
+		gapStart += length;
+	}
+
+	void Editor::GapBuffer::erase(size_t pos, size_t length) {
+		move_gap(pos);
+		gapEnd += length;
+	}
+
+	void Editor::GapBuffer::copy(size_t pos, size_t length, char *out) const {
+		size_t before = pos < gapStart ? std::min(length, gapStart - pos) : 0;
+		if (before)
+			memcpy(out, &data[pos], before);
+		if (length > before)
+			memcpy(out + before, &data[pos + before + (gapEnd - gapStart)], length - before);
+	}
+
+	Editor::Editor() {}
+	Editor::Editor(FontAtlas::object_ref fonts, int fontIndex) : m_fonts(fonts), m_fontIndex(fontIndex) {}
+
+	void Editor::set_font(FontAtlas::object_ref fonts, int fontIndex) {
+		m_fonts = fonts;
+		m_fontIndex = fontIndex;
+		m_offsetsLine = SIZE_MAX;
+	}
+
+	void Editor::set_text(const char *text, size_t length) {
+		m_text.data.assign(text, text + length);
+		m_text.gapStart = m_text.gapEnd = length;
+		m_lineStarts.assign(1, 0);
+		for (size_t i = 0; i < length; i++) {
+			if (text[i] == '\n')
+				m_lineStarts.push_back(i + 1);
+		}
+		m_shiftFrom = m_lineStarts.size();
+		m_shift = 0;
+		m_cursor = 0;
+		m_cursorLine = 0;
+		m_goalX = -1.0f;
+		m_offsetsLine = SIZE_MAX;
+		m_scroll = { 0.0f, 0.0f };
+	}
+
+	std::string Editor::contents() const {
+		std::string text(m_text.size(), '\0');
+		m_text.copy(0, text.size(), &text[0]);
+		return text;
+	}
+
+	size_t Editor::length() const {
+		return m_text.size();
+	}
+
+	void Editor::clear() {
+		set_text("", 0);
+	}
+
+	size_t Editor::line_count() const {
+		return m_lineStarts.size();
+	}
+
+	size_t Editor::line_start(size_t line) const {
+		assert(line < m_lineStarts.size());
+		return m_lineStarts[line] + (line >= m_shiftFrom ? m_shift : 0);
+	}
+
+	size_t Editor::line_end(size_t line) const {
+		return line + 1 < m_lineStarts.size() ? line_start(line + 1) - 1 : m_text.size();
+	}
+
+	size_t Editor::line_of(size_t pos) const {
+		// the last line starting at or before pos
+		size_t lo = 1, hi = m_lineStarts.size();
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (line_start(mid) <= pos)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo - 1;
+	}
+
+	float Editor::line_height() const {
+		const auto &fontInfo = m_fonts->fontInfo(m_fontIndex);
+		return fontInfo.ascent - fontInfo.descent + fontInfo.linegap;
+	}
+
+	void Editor::shift_lines(size_t from, ptrdiff_t delta) {
+		// entries between the old and the new boundary change sides, fold the pending shift in or out of them
+		// stored values may wrap around, reading them back adds the shift again
+		size_t count = m_lineStarts.size();
+		for (size_t i = from; i < m_shiftFrom && i < count; i++)
+			m_lineStarts[i] -= m_shift;
+		for (size_t i = m_shiftFrom; i < from && i < count; i++)
+			m_lineStarts[i] += m_shift;
+		m_shiftFrom = from;
+		m_shift += delta;
+	}
+
+	size_t Editor::next_boundary(size_t pos) const {
+		size_t size = m_text.size();
+		if (pos < size)
+			pos++;
+		while (pos < size && is_continuation(m_text.at(pos)))
+			pos++;
+		return pos;
+	}
+
+	size_t Editor::prev_boundary(size_t pos) const {
+		if (pos > 0)
+			pos--;
+		while (pos > 0 && is_continuation(m_text.at(pos)))
+			pos--;
+		return pos;
+	}
+
+	int Editor::codepoint_at(size_t pos) const {
+		if (pos >= m_text.size() || m_text.at(pos) == '\n')
+			return -1;
+		char bytes[4];
+		size_t n = std::min<size_t>(next_boundary(pos) - pos, sizeof(bytes));
+		m_text.copy(pos, n, bytes);
+		const char *p = bytes;
+		return (int)utf8::decode(p, bytes + n);
+	}
+
+	int Editor::codepoint_before(size_t pos) const {
+		if (pos == 0)
+			return -1;
+		return codepoint_at(prev_boundary(pos));
+	}
+
+	float Editor::advance(const char *bytes, size_t length) const {
+		// measuring doesn't rasterize, so walking past glyphs that are never drawn stays cheap
+		return m_fonts->measure_run(m_fontIndex, bytes, length);
+	}
+
+	float Editor::kerning(int first, int second) const {
+		if (first < 0 || second < 0)
+			return 0.0f;
+		return m_fonts->kerning(m_fontIndex, first, second);
+	}
+
+	// calls fn(bytes, length) for the parts of [start, end) on either side of the gap until it returns false
+	// the gap only ever sits at the cursor, so codepoints are never split between the parts
+	template<typename F>
+	void Editor::for_each_piece(size_t start, size_t end, F &&fn) const {
+		size_t gapStart = m_text.gapStart;
+		size_t gapSize = m_text.gapEnd - m_text.gapStart;
+		if (start < gapStart) {
+			size_t stop = std::min(end, gapStart);
+			if (!fn(&m_text.data[start], stop - start))
+				return;
+			start = stop;
+		}
+		if (start < end)
+			fn(&m_text.data[start + gapSize], end - start);
+	}
+
+	const std::vector<float> &Editor::offsets(size_t line) {
+		if (m_offsetsLine == line)
+			return m_offsets;
+
+		size_t start = line_start(line);
+		size_t end = line_end(line);
+		m_offsets.resize(end - start + 1);
+		float x = 0.0f;
+		int prev = -1;
+		size_t i = 0;
+		for_each_piece(start, end, [&](const char *text, size_t length) {
+			const char *p = text;
+			const char *stop = text + length;
+			while (p < stop) {
+				const char *first = p;
+				int codepoint = (int)utf8::decode(p, stop);
+				for (const char *c = first; c < p; c++)
+					m_offsets[i++] = x;
+				x += kerning(prev, codepoint) + advance(first, p - first);
+				prev = codepoint;
+			}
+			return true;
+		});
+		m_offsets[i] = x;
+		m_offsetsLine = line;
+		return m_offsets;
+	}
+
+	// inserting text without line breaks into the line with offsets, called before the buffer changes
+	// the following codepoint moves by the inserted width, everything after it also picks up the kerning change at the seam
+	void Editor::patch_insert(size_t pos, const char *text, size_t length) {
+		size_t b = pos - line_start(m_offsetsLine);
+		int before = codepoint_before(pos);
+		int after = codepoint_at(pos);
+		size_t afterLength = after >= 0 ? next_boundary(pos) - pos : 1;
+
+		std::vector<float> added(length);
+		float x = m_offsets[b];
+		int prev = before;
+		const char *p = text;
+		const char *stop = text + length;
+		size_t i = 0;
+		while (p < stop) {
+			const char *first = p;
+			int codepoint = (int)utf8::decode(p, stop);
+			for (const char *c = first; c < p; c++)
+				added[i++] = x;
+			x += kerning(prev, codepoint) + advance(first, p - first);
+			prev = codepoint;
+		}
+
+		float moved = x - m_offsets[b];
+		float rest = moved + kerning(prev, after) - kerning(before, after);
+		for (size_t j = b; j < b + afterLength; j++)
+			m_offsets[j] += moved;
+		for (size_t j = b + afterLength; j < m_offsets.size(); j++)
+			m_offsets[j] += rest;
+		m_offsets.insert(m_offsets.begin() + b, added.begin(), added.end());
+	}
+
+	// erasing [pos, end) within the line with offsets, called before the buffer changes
+	void Editor::patch_erase(size_t pos, size_t end) {
+		size_t start = line_start(m_offsetsLine);
+		size_t b = pos - start;
+		size_t e = end - start;
+		int before = codepoint_before(pos);
+		int last = codepoint_before(end);
+		int after = codepoint_at(end);
+		size_t afterLength = after >= 0 ? next_boundary(end) - end : 1;
+
+		float moved = m_offsets[b] - m_offsets[e];
+		float rest = moved + kerning(before, after) - kerning(last, after);
+		for (size_t j = e; j < e + afterLength; j++)
+			m_offsets[j] += moved;
+		for (size_t j = e + afterLength; j < m_offsets.size(); j++)
+			m_offsets[j] += rest;
+		m_offsets.erase(m_offsets.begin() + b, m_offsets.begin() + e);
+	}
+
+	void Editor::set_cursor(size_t pos) {
+		pos = std::min(pos, m_text.size());
+		while (pos > 0 && pos < m_text.size() && is_continuation(m_text.at(pos)))
+			pos--;
+		m_cursor = pos;
+		m_cursorLine = line_of(pos);
+		m_goalX = -1.0f;
+	}
+
+	void Editor::move_cursor(int codepoints) {
+		size_t pos = m_cursor;
+		for (; codepoints > 0; codepoints--)
+			pos = next_boundary(pos);
+		for (; codepoints < 0; codepoints++)
+			pos = prev_boundary(pos);
+		set_cursor(pos);
+	}
+
+	void Editor::move_lines(int lines) {
+		if (m_goalX < 0.0f)
+			m_goalX = offsets(m_cursorLine)[m_cursor - line_start(m_cursorLine)];
+
+		ptrdiff_t target = (ptrdiff_t)m_cursorLine + lines;
+		target = std::max<ptrdiff_t>(0, std::min<ptrdiff_t>(target, (ptrdiff_t)line_count() - 1));
+		const auto &xs = offsets((size_t)target);
+		// the codepoint boundary closest to the goal, continuation bytes share the x of their codepoint
+		// so the lower bound lands on a boundary
+		size_t start = line_start((size_t)target);
+		size_t i = std::lower_bound(xs.begin(), xs.end(), m_goalX) - xs.begin();
+		i = std::min(i, xs.size() - 1);
+		if (i > 0) {
+			size_t prev = prev_boundary(start + i) - start;
+			if (m_goalX - xs[prev] < xs[i] - m_goalX)
+				i = prev;
+		}
+		m_cursor = start + i;
+		m_cursorLine = (size_t)target;
+	}
+
+	void Editor::move_home() {
+		set_cursor(line_start(m_cursorLine));
+	}
+
+	void Editor::move_end() {
+		set_cursor(line_end(m_cursorLine));
+	}
+
+	void Editor::input(const char *text) {
+		insert(text, strlen(text));
+	}
+
+	void Editor::insert(const char *text, size_t length) {
+		if (!length)
+			return;
+		size_t pos = m_cursor;
+		size_t line = m_cursorLine;
+		bool breaks = memchr(text, '\n', length) != nullptr;
+		if (breaks)
+			m_offsetsLine = SIZE_MAX;
+		else if (m_offsetsLine == line)
+			patch_insert(pos, text, length);
+
+		m_text.insert(pos, text, length);
+		shift_lines(line + 1, (ptrdiff_t)length);
+		if (breaks) {
+			// new lines go right after the edited one, on the shifted side of the boundary
+			std::vector<size_t> starts;
+			for (size_t i = 0; i < length; i++) {
+				if (text[i] == '\n')
+					starts.push_back(pos + i + 1 - m_shift);
+			}
+			m_lineStarts.insert(m_lineStarts.begin() + line + 1, starts.begin(), starts.end());
+		}
+		m_cursor = pos + length;
+		m_cursorLine = breaks ? line_of(m_cursor) : line;
+		m_goalX = -1.0f;
+	}
+
+	void Editor::erase(int codepoints) {
+		size_t b = m_cursor, e = m_cursor;
+		for (; codepoints > 0; codepoints--)
+			e = next_boundary(e);
+		for (; codepoints < 0; codepoints++)
+			b = prev_boundary(b);
+		if (b == e)
+			return;
+
+		size_t first = line_of(b);
+		size_t last = line_of(e);
+		if (last != first)
+			m_offsetsLine = SIZE_MAX;
+		else if (m_offsetsLine == first)
+			patch_erase(b, e);
+
+		m_text.erase(b, e - b);
+		if (last != first) {
+			// the lines starting inside the erased range merge into the first one
+			shift_lines(first + 1, 0);
+			m_lineStarts.erase(m_lineStarts.begin() + first + 1, m_lineStarts.begin() + last + 1);
+		}
+		shift_lines(first + 1, -(ptrdiff_t)(e - b));
+		m_cursor = b;
+		m_cursorLine = first;
+		m_goalX = -1.0f;
+	}
+
+	void Editor::flush() {
+		if (!m_rects.empty())
+			draw_rects(m_fonts->tex(m_page), m_rects.data(), m_crops.data(), m_colors.data(), (int)m_rects.size());
+		m_rects.clear();
+		m_crops.clear();
+		m_colors.clear();
+	}
+
+	void Editor::draw(Rect bounds, glm::vec4 color) {
+		const auto &fontInfo = m_fonts->fontInfo(m_fontIndex);
+		float lineHeight = line_height();
+		const float cursorWidth = 2.0f;
+
+		// scroll just enough to keep the cursor in view
+		float cursorX = offsets(m_cursorLine)[m_cursor - line_start(m_cursorLine)];
+		float cursorY = m_cursorLine * lineHeight;
+		m_scroll.x = std::min(m_scroll.x, cursorX);
+		m_scroll.x = std::max(m_scroll.x, cursorX + cursorWidth - bounds.size.x);
+		m_scroll.y = std::min(m_scroll.y, cursorY);
+		m_scroll.y = std::max(m_scroll.y, cursorY + lineHeight - bounds.size.y);
+		m_scroll = glm::max(m_scroll, glm::vec2(0.0f));
+		m_cursorRect = { bounds.pos.x + cursorX - m_scroll.x, bounds.pos.y + cursorY - m_scroll.y, cursorWidth, fontInfo.ascent };
+
+		m_rects.clear();
+		m_crops.clear();
+		m_colors.clear();
+		m_page = 0;
+
+		// TODO lines and glyphs cut by the edges of bounds aren't clipped
+		// TODO perhaps the text should be vertically centered when bounds are taller than the text
+		float right = m_scroll.x + bounds.size.x;
+		size_t first = (size_t)(m_scroll.y / lineHeight);
+		size_t last = std::min(line_count(), (size_t)std::ceil((m_scroll.y + bounds.size.y) / lineHeight));
+		for (size_t line = first; line < last; line++) {
+			float baseline = bounds.pos.y + line * lineHeight - m_scroll.y + fontInfo.ascent;
+			size_t start = line_start(line);
+			size_t end = line_end(line);
+			float x = 0.0f;
+			int prev = -1;
+			// the line with offsets can start at the first visible codepoint, others are walked from their start
+			if (line == m_offsetsLine && m_scroll.x > 0.0f) {
+				size_t i = std::upper_bound(m_offsets.begin(), m_offsets.end(), m_scroll.x) - m_offsets.begin();
+				i = i ? i - 1 : 0;
+				while (i > 0 && start + i < end && is_continuation(m_text.at(start + i)))
+					i--;
+				x = m_offsets[i];
+				prev = codepoint_before(start + i);
+				start += i;
+			}
+
+			for_each_piece(start, end, [&](const char *text, size_t length) {
+				const char *p = text;
+				const char *stop = text + length;
+				while (p < stop && x <= right) {
+					const char *bytes = p;
+					int codepoint = (int)utf8::decode(p, stop);
+					float pen = x + kerning(prev, codepoint);
+					x = pen + advance(bytes, p - bytes);
+					prev = codepoint;
+					if (x < m_scroll.x)
+						continue;
+
+					auto info = m_fonts->glyphInfo(m_fontIndex, codepoint);
+					// glyphs come from several atlas pages, draw a batch whenever the page changes
+					if (info.page != m_page) {
+						flush();
+						m_page = info.page;
+					}
+					m_rects.push_back(info.bounds.offset(bounds.pos.x + pen - m_scroll.x, baseline));
+					m_crops.push_back(info.crop);
+					m_colors.push_back(color);
+				}
+				return x <= right;
+			});
+		}
+		flush();
+	}
+}}
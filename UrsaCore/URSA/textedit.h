@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// editable multi-line text in a single font, include after URSA.h
+namespace ursa { namespace text {
+
+	// the text lives in a gap buffer that follows the cursor, so typing and deleting only move the bytes between
+	// the old and new edit position; the cursor line keeps a table of glyph x offsets that edits patch in place,
+	// and drawing only walks the lines and columns inside the view
+	// positions are byte offsets into the UTF-8 text, the cursor always sits on a codepoint boundary
+	class Editor {
+	public:
+		Editor();
+		Editor(FontAtlas::object_ref fonts, int fontIndex);
+
+		void set_font(FontAtlas::object_ref fonts, int fontIndex);
+
+		void set_text(const char *text, size_t length);
+		std::string contents() const;
+		size_t length() const;
+		void clear();
+
+		size_t line_count() const;
+		size_t line_start(size_t line) const;
+		// end of the line's text, not counting the '\n'
+		size_t line_end(size_t line) const;
+		size_t line_of(size_t pos) const;
+		float line_height() const;
+
+		size_t cursor() const { return m_cursor; }
+		void set_cursor(size_t pos);
+		// moves by codepoints, going past the ends of lines
+		void move_cursor(int codepoints);
+		// moves up or down, keeping the horizontal position of the first move
+		void move_lines(int lines);
+		void move_home();
+		void move_end();
+
+		// inserts at the cursor and moves the cursor past the text
+		void input(const char *text);
+		void insert(const char *text, size_t length);
+		// deletes codepoints after the cursor, or before it for negative counts
+		void erase(int codepoints);
+
+		// draws the visible part of the text, scrolling to keep the cursor inside bounds
+		void draw(Rect bounds, glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f });
+		// where the last draw placed the cursor, a line tall
+		// TODO hardcoded cursor width of 2 pixels is not necessarily a good thing
+		Rect cursor_rect() const { return m_cursorRect; }
+
+	private:
+		struct GapBuffer {
+			std::vector<char> data;
+			size_t gapStart = 0, gapEnd = 0;
+
+			size_t size() const { return data.size() - (gapEnd - gapStart); }
+			char at(size_t pos) const { return data[pos < gapStart ? pos : pos + (gapEnd - gapStart)]; }
+			void move_gap(size_t pos);
+			void insert(size_t pos, const char *text, size_t length);
+			void erase(size_t pos, size_t length);
+			void copy(size_t pos, size_t length, char *out) const;
+		};
+
+		void shift_lines(size_t from, ptrdiff_t delta);
+		size_t next_boundary(size_t pos) const;
+		size_t prev_boundary(size_t pos) const;
+		// the codepoint starting at pos or ending at pos, -1 outside the text or at line breaks
+		int codepoint_at(size_t pos) const;
+		int codepoint_before(size_t pos) const;
+		float advance(const char *bytes, size_t length) const;
+		float kerning(int first, int second) const;
+
+		const std::vector<float> &offsets(size_t line);
+		void patch_insert(size_t pos, const char *text, size_t length);
+		void patch_erase(size_t pos, size_t end);
+
+		template<typename F>
+		void for_each_piece(size_t start, size_t end, F &&fn) const;
+		void flush();
+
+		FontAtlas::object_ref m_fonts = { 0 };
+		int m_fontIndex = 0;
+
+		GapBuffer m_text;
+		// line starts from m_shiftFrom on still need m_shift added, edits near the cursor leave the rest alone
+		std::vector<size_t> m_lineStarts{ 0 };
+		size_t m_shiftFrom = 1;
+		ptrdiff_t m_shift = 0;
+
+		size_t m_cursor = 0;
+		size_t m_cursorLine = 0;
+		// x kept by vertical moves, negative when unset
+		float m_goalX = -1.0f;
+
+		// x of every byte of one line relative to the line start, one more entry for the end of the line
+		// continuation bytes repeat the x of their codepoint
+		size_t m_offsetsLine = SIZE_MAX;
+		std::vector<float> m_offsets;
+
+		glm::vec2 m_scroll = { 0.0f, 0.0f };
+		Rect m_cursorRect;
+
+		// reused between draws
+		std::vector<Rect> m_rects;
+		std::vector<Rect> m_crops;
+		std::vector<glm::vec4> m_colors;
+		int m_page = 0;
+	};
+}}
@@ -0,0 +1,300 @@
+#include "URSA.h"
+#include "textlayout.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace ursa { namespace text {
+
+	static bool is_space(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+	}
+
+	Layout::Layout() {}
+	Layout::Layout(FontAtlas::object_ref fonts) : m_fonts(fonts) {}
+
+	void Layout::clear() {
+		m_chars.clear();
+		m_spans.clear();
+		m_tokens.clear();
+		m_tokenWidths.clear();
+		m_lines.clear();
+		m_heights.clear();
+	}
+
+	void Layout::append(const char *text, size_t length, const glm::vec4 &color, int fontIndex) {
+		if (m_lines.empty())
+			newline();
+		line_changed(m_lines.size() - 1);
+
+		// split into alternating runs of whitespace and words
+		const char *end = text + length;
+		const char *p = text;
+		while (p < end) {
+			if (*p == '\n') {
+				m_lines.back().fontIndex = fontIndex;
+				newline();
+				p++;
+				continue;
+			}
+			bool whitespace = is_space(*p);
+			const char *start = p;
+			while (p < end && *p != '\n' && is_space(*p) == whitespace)
+				p++;
+			add_piece(start, p - start, whitespace, color, fontIndex);
+		}
+		m_lines.back().fontIndex = fontIndex;
+	}
+
+	void Layout::append(const std::string &text, const glm::vec4 &color, int fontIndex) {
+		append(text.data(), text.size(), color, fontIndex);
+	}
+
+	void Layout::append_line(const std::string &text, const glm::vec4 &color, int fontIndex) {
+		append(text, color, fontIndex);
+		newline();
+	}
+
+	void Layout::newline() {
+		Line line;
+		line.firstToken = (uint32_t)m_tokens.size();
+		if (!m_lines.empty())
+			line.fontIndex = m_lines.back().fontIndex;
+		m_lines.push_back(line);
+		m_heights.push_back(estimate_height(line));
+	}
+
+	// one row of the line's font until it gets laid out, nothing while there are no fonts to ask
+	float Layout::estimate_height(const Line &line) const {
+		if (!m_fonts.valid())
+			return 0.0f;
+		const auto &fontInfo = m_fonts->fontInfo(line.fontIndex);
+		return fontInfo.ascent - fontInfo.descent + fontInfo.linegap;
+	}
+
+	void Layout::add_piece(const char *text, size_t length, bool whitespace, const glm::vec4 &color, int fontIndex) {
+		Line &line = m_lines.back();
+		// a run continuing the last token of the line, e.g. a word split over two appends, joins that token
+		bool join = line.tokenCount && m_tokens.back().whitespace == whitespace;
+		if (!join) {
+			m_tokens.push_back({ (uint32_t)m_spans.size(), 0, whitespace });
+			m_tokenWidths.push_back(0.0f);
+			line.tokenCount++;
+		}
+		Token &token = m_tokens.back();
+
+		// same style right after the previous span just extends it
+		if (join) {
+			Span &last = m_spans.back();
+			if (last.offset + last.length == m_chars.size() && last.color == color && last.fontIndex == fontIndex) {
+				m_chars.append(text, length);
+				last.length += (uint32_t)length;
+				return;
+			}
+		}
+		m_spans.push_back({ (uint32_t)m_chars.size(), (uint32_t)length, color, fontIndex });
+		m_chars.append(text, length);
+		token.spanCount++;
+	}
+
+	void Layout::line_changed(size_t line) {
+		m_lines[line].stamp = 0;
+	}
+
+	void Layout::set_fonts(FontAtlas::object_ref fonts) {
+		m_fonts = fonts;
+		invalidate();
+		// laid out lines get their real height when next visited, the rest only have an estimate from the old fonts
+		for (size_t i = 0; i < m_lines.size(); i++) {
+			if (m_lines[i].stamp == 0)
+				m_heights.set(i, estimate_height(m_lines[i]));
+		}
+	}
+
+	void Layout::set_width(float width) {
+		if (width == m_width)
+			return;
+		// lines notice the new width when they are next laid out, token widths stay valid
+		m_width = width;
+	}
+
+	void Layout::invalidate() {
+		m_stamp++;
+	}
+
+	size_t Layout::line_count() const {
+		return m_lines.size();
+	}
+
+	const Layout::Line &Layout::layout_line(size_t index) {
+		Line &line = m_lines[index];
+		bool measured = line.stamp == m_stamp;
+		if (measured && line.wrapWidth == m_width)
+			return line;
+
+		if (!measured) {
+			for (uint32_t t = line.firstToken; t < line.firstToken + line.tokenCount; t++) {
+				const Token &token = m_tokens[t];
+				float width = 0.0f;
+				for (uint32_t s = token.firstSpan; s < token.firstSpan + token.spanCount; s++)
+					width += m_fonts->measure_run(m_spans[s].fontIndex, m_chars.data() + m_spans[s].offset, m_spans[s].length);
+				m_tokenWidths[t] = width;
+			}
+			line.stamp = m_stamp;
+		}
+
+		// greedy wrapping, every row takes the tallest metrics of the spans on it
+		// TODO should whitespace tokens be omitted from rendering when they are adjacent to the wrap position?
+		line.wrapWidth = m_width;
+		line.rows.clear();
+		line.rows.push_back({ 0, 0.0f, 0.0f, 0.0f });
+		float x = 0.0f;
+		for (uint32_t t = line.firstToken; t < line.firstToken + line.tokenCount; t++) {
+			float width = m_tokenWidths[t];
+			if (x > 0.0f && x + width > m_width) {
+				x = 0.0f;
+				line.rows.push_back({ 0, 0.0f, 0.0f, 0.0f });
+			}
+			x += width;
+
+			Row &row = line.rows.back();
+			const Token &token = m_tokens[t];
+			for (uint32_t s = token.firstSpan; s < token.firstSpan + token.spanCount; s++) {
+				const auto &fontInfo = m_fonts->fontInfo(m_spans[s].fontIndex);
+				row.gap = std::max(row.gap, fontInfo.linegap);
+				row.baseline = std::max(row.baseline, fontInfo.ascent);
+				row.descent = std::min(row.descent, fontInfo.descent);
+			}
+			row.tokens++;
+		}
+		if (!line.tokenCount) {
+			const auto &fontInfo = m_fonts->fontInfo(line.fontIndex);
+			line.rows.back() = { 0, fontInfo.ascent, fontInfo.descent, fontInfo.linegap };
+		}
+
+		line.height = 0.0f;
+		for (const auto &row : line.rows)
+			line.height += row.baseline - row.descent + row.gap;
+		// replaces the estimate, everything below moves in O(log n)
+		if (m_heights.get(index) != line.height)
+			m_heights.set(index, line.height);
+		return line;
+	}
+
+	float Layout::line_top(size_t line) const {
+		return (float)m_heights.sum(line);
+	}
+
+	float Layout::line_height(size_t line) {
+		assert(line < m_lines.size());
+		return layout_line(line).height;
+	}
+
+	size_t Layout::line_at(float offset) const {
+		return m_heights.find(offset);
+	}
+
+	float Layout::height() const {
+		return (float)m_heights.total();
+	}
+
+	void Layout::flush() {
+		if (!m_rects.empty())
+			draw_rects(m_fonts->tex(m_page), m_rects.data(), m_crops.data(), m_colors.data(), (int)m_rects.size());
+		m_rects.clear();
+		m_crops.clear();
+		m_colors.clear();
+	}
+
+	void Layout::draw_line(const Line &line, float left, float top) {
+		size_t r = 0;
+		uint32_t rowTokens = 0;
+		float x = left;
+		float y = top + line.rows[0].baseline;
+		for (uint32_t t = line.firstToken; t < line.firstToken + line.tokenCount; t++) {
+			if (rowTokens >= line.rows[r].tokens) {
+				x = left;
+				y += line.rows[r].gap - line.rows[r].descent + line.rows[r + 1].baseline;
+				r++;
+				rowTokens = 0;
+			}
+			const Token &token = m_tokens[t];
+			for (uint32_t s = token.firstSpan; s < token.firstSpan + token.spanCount; s++) {
+				const Span &span = m_spans[s];
+				int prev = -1;
+				utf8::for_each(m_chars.data() + span.offset, span.length, [&](uint32_t codepoint) {
+					if (prev >= 0)
+						x += m_fonts->kerning(span.fontIndex, prev, (int)codepoint);
+					prev = (int)codepoint;
+					auto info = m_fonts->glyphInfo(span.fontIndex, (int)codepoint);
+					// glyphs come from several atlas pages, draw a batch whenever the page changes
+					if (info.page != m_page) {
+						flush();
+						m_page = info.page;
+					}
+					m_rects.push_back(info.bounds.offset(x, y));
+					m_crops.push_back(info.crop);
+					m_colors.push_back(span.color);
+					x += info.xadvance;
+				});
+			}
+			rowTokens++;
+		}
+	}
+
+	void Layout::draw(Rect bounds, float scroll) {
+		set_width(bounds.size.x);
+		if (m_lines.empty())
+			return;
+
+		m_rects.clear();
+		m_crops.clear();
+		m_colors.clear();
+		m_page = 0;
+
+		size_t first = line_at(scroll);
+		// laying a line out only moves the lines below it, so the first top stays put
+		float y = bounds.pos.y + line_top(first) - scroll;
+		for (size_t i = first; i < m_lines.size() && y < bounds.bottom(); i++) {
+			const Line &line = layout_line(i);
+			draw_line(line, bounds.pos.x, y);
+			y += line.height;
+		}
+		flush();
+	}
+
+	View::View() {}
+	View::View(FontAtlas::object_ref fonts) : m_layout(fonts) {}
+
+	void View::scroll_to(float offset) {
+		m_scroll = offset;
+		m_follow = false;
+	}
+
+	void View::scroll_by(float delta) {
+		scroll_to(m_scroll + delta);
+	}
+
+	void View::scroll_to_line(size_t line) {
+		scroll_to(m_layout.line_top(line));
+	}
+
+	void View::draw(Rect bounds) {
+		m_layout.set_width(bounds.size.x);
+		size_t count = m_layout.line_count();
+		if (m_follow) {
+			// lay out the lines at the end so the bottom lands exactly at the bottom of the view
+			float filled = 0.0f;
+			for (size_t i = count; i-- > 0 && filled < bounds.size.y;)
+				filled += m_layout.line_height(i);
+			m_scroll = m_layout.height() - bounds.size.y;
+		}
+
+		float bottom = std::max(0.0f, m_layout.height() - bounds.size.y);
+		m_scroll = std::max(0.0f, std::min(m_scroll, bottom));
+		if (m_scroll >= bottom)
+			m_follow = true;
+		m_layout.draw(bounds, m_scroll);
+	}
+}}
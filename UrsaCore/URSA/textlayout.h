@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "prefixsum.h"
+
+// word wrapped text made of spans with their own color and font, include after URSA.h
+namespace ursa { namespace text {
+
+	// span text is kept in one growing buffer, lines refer to ranges of tokens and tokens to ranges of spans
+	// every line caches its measured tokens and wrap result, appending only lays out the last line again
+	// and changing the width only rewraps, so adding a line to a long log costs O(line)
+	// line heights are indexed by a prefix sum, lines are laid out lazily when they are drawn or asked about
+	// and until then count with their last known height, or one row of their font
+	class Layout {
+	public:
+		Layout();
+		explicit Layout(FontAtlas::object_ref fonts);
+
+		void clear();
+
+		// '\n' starts a new line, other whitespace separates the words that wrapping moves around
+		void append(const char *text, size_t length, const glm::vec4 &color = { 1.0f, 1.0f, 1.0f, 1.0f }, int fontIndex = 0);
+		void append(const std::string &text, const glm::vec4 &color = { 1.0f, 1.0f, 1.0f, 1.0f }, int fontIndex = 0);
+		void append_line(const std::string &text, const glm::vec4 &color = { 1.0f, 1.0f, 1.0f, 1.0f }, int fontIndex = 0);
+		void newline();
+
+		void set_fonts(FontAtlas::object_ref fonts);
+		// lines wider than this wrap between words, words that don't fit on a line of their own overflow
+		void set_width(float width);
+		// measurements are kept until this is called, e.g. after rebaking the fonts
+		void invalidate();
+
+		size_t line_count() const;
+		// top of a line relative to the top of the layout, O(log n)
+		float line_top(size_t line) const;
+		// lays the line out if needed, height includes the wrapped rows
+		float line_height(size_t line);
+		// the line covering an offset from the top, O(log n)
+		size_t line_at(float offset) const;
+		float height() const;
+
+		// wraps to the width of bounds and draws the lines overlapping it, starting scroll pixels down the layout
+		// only those lines are laid out
+		// TODO lines cut by the edges of bounds aren't clipped
+		void draw(Rect bounds, float scroll = 0.0f);
+
+	private:
+		struct Span {
+			uint32_t offset, length;
+			glm::vec4 color;
+			int fontIndex;
+		};
+		struct Token {
+			uint32_t firstSpan, spanCount;
+			bool whitespace;
+		};
+		// a row of a line after wrapping
+		struct Row {
+			uint32_t tokens;
+			float baseline, descent, gap;
+		};
+		struct Line {
+			uint32_t firstToken = 0, tokenCount = 0;
+			// empty lines still take the height of the font used when they were started
+			int fontIndex = 0;
+			// cached layout, stale when the stamp or the wrap width differ from the layout's
+			uint32_t stamp = 0;
+			float wrapWidth = -1.0f;
+			float height = 0.0f;
+			std::vector<Row> rows;
+		};
+
+		void add_piece(const char *text, size_t length, bool whitespace, const glm::vec4 &color, int fontIndex);
+		void line_changed(size_t line);
+		float estimate_height(const Line &line) const;
+		const Line &layout_line(size_t line);
+		void draw_line(const Line &line, float x, float y);
+		void flush();
+
+		FontAtlas::object_ref m_fonts = { 0 };
+		float m_width = 0.0f;
+		uint32_t m_stamp = 1;
+
+		std::string m_chars;
+		std::vector<Span> m_spans;
+		std::vector<Token> m_tokens;
+		// measured advance of every token, filled when its line is laid out
+		std::vector<float> m_tokenWidths;
+		std::vector<Line> m_lines;
+		PrefixSum m_heights;
+
+		// reused between draws
+		std::vector<Rect> m_rects;
+		std::vector<Rect> m_crops;
+		std::vector<glm::vec4> m_colors;
+		int m_page = 0;
+	};
+
+	// a scrolling window onto a layout, drawing costs depend on the size of the view rather than the length of the text
+	class View {
+	public:
+		View();
+		explicit View(FontAtlas::object_ref fonts);
+
+		Layout &layout() { return m_layout; }
+
+		// offset of the top of the view into the layout
+		float scroll() const { return m_scroll; }
+		void scroll_to(float offset);
+		void scroll_by(float delta);
+		void scroll_to_line(size_t line);
+
+		// a following view stays at the bottom as lines are appended, like a log
+		// scrolling up stops following, scrolling back down to the end resumes it
+		void set_follow(bool follow) { m_follow = follow; }
+		bool following() const { return m_follow; }
+
+		void draw(Rect bounds);
+
+	private:
+		Layout m_layout;
+		float m_scroll = 0.0f;
+		bool m_follow = true;
+	};
+}}
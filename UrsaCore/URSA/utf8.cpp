@@ -0,0 +1,65 @@
+#include "utf8.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define URSA_UTF8_SSE2
+#endif
+
+namespace ursa { namespace utf8 {
+
+	size_t ascii_run(const char *text, size_t length) {
+		size_t i = 0;
+#ifdef URSA_UTF8_SSE2
+		for (; i + 16 <= length; i += 16) {
+			// the sign bit is set exactly for the non-ASCII bytes
+			int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i)));
+			if (mask) {
+				unsigned bits = (unsigned)mask;
+				while (!(bits & 1)) {
+					bits >>= 1;
+					i++;
+				}
+				return i;
+			}
+		}
+#endif
+		while (i < length && !(text[i] & 0x80))
+			i++;
+		return i;
+	}
+
+	uint32_t decode(const char *&p, const char *end) {
+		const unsigned char *s = reinterpret_cast<const unsigned char*>(p);
+		unsigned char c = s[0];
+		if (c < 0x80) {
+			p++;
+			return c;
+		}
+
+		int extra;
+		uint32_t cp, min;
+		if ((c & 0xE0) == 0xC0) { extra = 1; cp = c & 0x1F; min = 0x80; }
+		else if ((c & 0xF0) == 0xE0) { extra = 2; cp = c & 0x0F; min = 0x800; }
+		else if ((c & 0xF8) == 0xF0) { extra = 3; cp = c & 0x07; min = 0x10000; }
+		else { p++; return replacement; }
+
+		if (end - p <= extra) {
+			p++;
+			return replacement;
+		}
+		for (int i = 1; i <= extra; i++) {
+			if ((s[i] & 0xC0) != 0x80) {
+				p++;
+				return replacement;
+			}
+			cp = (cp << 6) | (s[i] & 0x3F);
+		}
+		// overlong forms, surrogates and values past the unicode range
+		if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+			p++;
+			return replacement;
+		}
+		p += extra + 1;
+		return cp;
+	}
+}}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ursa { namespace utf8 {
+
+	const uint32_t replacement = 0xFFFD;
+
+	// number of leading ASCII bytes, checked 16 at a time where SSE2 is available
+	size_t ascii_run(const char *text, size_t length);
+
+	// decodes one codepoint and advances p, malformed sequences yield U+FFFD and skip a single byte
+	uint32_t decode(const char *&p, const char *end);
+
+	// calls fn(codepoint) for every codepoint, ASCII runs skip the decoder
+	template<typename F>
+	void for_each(const char *text, size_t length, F &&fn) {
+		const char *p = text;
+		const char *end = text + length;
+		while (p < end) {
+			size_t run = ascii_run(p, end - p);
+			for (const char *stop = p + run; p < stop; p++)
+				fn((uint32_t)(unsigned char)*p);
+			if (p < end)
+				fn(decode(p, end));
+		}
+	}
+}}
@@ -4,241 +4,60 @@
 
 #include "URSA.h"
 #include "URSA/gui.h"
+#include "URSA/textedit.h"
+#include "URSA/textlayout.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <new>
 #include <vector>
 #include <algorithm>
-#include <regex>
 #include <glm/gtc/random.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-struct RectList {
-	std::vector<ursa::Rect> rects;
-	std::vector<ursa::Rect> crops;
-	std::vector<glm::vec4> colors;
+// heap allocations made by this thread while counting, see check_gui_allocations
+static thread_local bool t_counting = false;
+static thread_local size_t t_allocations = 0;
 
-	void addRect(const ursa::Rect &rect, const ursa::Rect &crop, const glm::vec4 &color) {
-		rects.push_back(rect);
-		crops.push_back(crop);
-		colors.push_back(color);
-	}
-};
-
-class TextBlock {
-	struct textspan {
-		std::string text;
-		glm::vec4 color;
-		int fontIndex;
-	};
-	struct texttoken {
-		std::vector<textspan> spans;
-	};
-	struct textline {
-		std::vector<texttoken> tokens;
-	};
-
-	const std::regex ws_re{ "\\s+" };
-
-public:
-	void clear() {
-		lines.clear();
-	}
-
-	void append(const std::string &text, const glm::vec4 &color = { 1.0f,1.0f,1.0f,1.0f }, int fontIndex = 0) {
-		if (lines.empty()) {
-			newline();
-		}
-
-		std::vector<std::string> tokens;
-		// the regex token iterator will create empty token if input begins with whitespace, but not if it ends with whitespace
-		std::copy(
-			std::sregex_token_iterator(text.begin(), text.end(), ws_re, { -1, 0 }),
-			std::sregex_token_iterator(),
-			std::back_inserter(tokens));
-
-		auto iter = tokens.begin();
-		// merge the first new token into the last old token, if applicable
-		auto &linetokens = lines.back().tokens;
-		if (linetokens.size() > 0) {
-			bool lastIsWS = std::regex_match(linetokens.back().spans.back().text, ws_re);
-			// if the line begins with whitespace, the first token is empty
-			if (iter->size() == 0) {
-				// skip the dummy zero-length token
-				++iter;
-				// check the last token on the line, to test for two adjancent whitespace tokens
-				// TODO maybe texttoken itself should know if it's a whitespace token
-				if (iter != tokens.end() && lastIsWS) {
-					// combine whitespaces
-					// TODO ideally, if the styles are equal, new span isn't needed
-					linetokens.back().spans.push_back({ *iter++, color, fontIndex });
-				}
-			} else {
-				// first new token isn't whitespace
-				if (!lastIsWS) {
-					// ... and neither is the last of the old ones, merge
-					linetokens.back().spans.push_back({ *iter++, color, fontIndex });
-				}
-			}
-		}
-		
-		// process the rest normally
-		for (; iter != tokens.end(); ++iter) {
-			// skip zero-length tokens
-			if (iter->size() == 0)
-				continue;
-			linetokens.emplace_back();
-			linetokens.back().spans.push_back({*iter, color, fontIndex});
-		}
-	}
-
-	void newline() {
-		lines.emplace_back();
-	}
-
-	void appendLine(const std::string &text, const glm::vec4 &color = { 1.0f,1.0f,1.0f,1.0f }, int fontIndex = 0) {
-		append(text, color, fontIndex);
-		newline();
-	}
-
-	RectList buildRects(ursa::FontAtlas::object_ref fonts, ursa::Rect bounds) {
-		RectList rects;
-		float x{ bounds.pos.x }, y{ bounds.pos.y };
-		for (const auto &line : lines) {
-			// perform word wrapping into virtual lines, count tokens per vline to be used for geometry pass
-			// TODO should whitespace tokens by omitted from rendering when they are adjacent to the wrap position?
-			struct virtual_line {
-				float gap{ 0 }, baseline{ 0 }, descent{ 0 };
-				int tokens{ 0 };
-			};
-			std::vector<virtual_line> vlines{ {} };
-			float vx = 0;
-			for (const auto &token : line.tokens) {
-				float tokenWidth = 0;
-				for (const auto &span : token.spans) {
-					const auto &fontInfo = fonts->fontInfo(span.fontIndex);
-					// FIXME using xadvance isn't entirely accurate
-					for (const auto &ch : span.text) {
-						auto info = fonts->glyphInfo(span.fontIndex, ch);
-						tokenWidth += info.xadvance;
-					}
-				}
-				if (vx > 0 && vx + tokenWidth > bounds.size.x) {
-					// wrapped, start new vline and place token there
-					// TODO support splitting full line tokens?
-					vx = 0;
-					vlines.emplace_back();
-				}
-				vx += tokenWidth;
-
-				// update current vline metrics based on token's sub-span metrics
-				auto &vline = vlines.back();
-				for (const auto &span : token.spans) {
-					const auto &fontInfo = fonts->fontInfo(span.fontIndex);
-					vline.gap = std::max(vline.gap, fontInfo.linegap);
-					vline.baseline = std::max(vline.baseline, fontInfo.ascent);
-					vline.descent = std::min(vline.descent, fontInfo.descent);
-				}
-				vline.tokens++;
-			}
-			// start from the first vline's baseline
-			y += vlines.front().baseline;
-
-			// gather the geometry for the line
-			int tokencounter = 0;
-			int vlinecounter = 0;
-			for (const auto &token : line.tokens) {
-				// test wrapping
-				if (tokencounter >= vlines[vlinecounter].tokens) {
-					x = bounds.pos.x;
-					// move to next vline's baseline
-					y += vlines[vlinecounter].gap + vlines[vlinecounter + 1].baseline - vlines[vlinecounter].descent;
-					vlinecounter++;
-					tokencounter = 0;
-				}
-				// generate token's geometry
-				for (const auto &span : token.spans) {
-					for (const auto &ch : span.text) {
-						auto info = fonts->glyphInfo(span.fontIndex, ch);
-						rects.addRect(info.bounds.offset(x, y), info.crop, span.color);
-						x += info.xadvance;
-					}
-				}
-				tokencounter++;
-			}
-
-			// next line
-			x = bounds.pos.x;
-			y += vlines.back().gap-vlines.back().descent;
-		}
-		return rects;
-	}
-private:
-	std::vector<textline> lines;
-};
-
-class EditLine {
-public:
-	void input(std::string text) {
-		line.insert(cursor, text);
-		cursor += text.length();
-	}
-	std::string contents() const {
-		return line;
-	}
-	size_t length() const {
-		return line.length();
-	}
-	void clear() {
-		line.clear();
-		cursor = 0;
-	}
-	void setCursor(int pos) {
-		//cursor = std::clamp(pos, 0, (int)length());
-		cursor = std::max(0, std::min(pos, (int)length()));
-	}
-	void offsetCursor(int offset) {
-		setCursor(cursor + offset);
-	}
-	void deleteOffset(int offset) {
-		// when deleting backwards, move cursor first and delete forwards up to current position
-		if (offset < 0) {
-			int tmp = cursor;
-			offsetCursor(offset);
-			offset = tmp - cursor;
-		}
-		line.erase(cursor, offset);
+void *operator new(size_t size) {
+	if (t_counting)
+		t_allocations++;
+	if (void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// once a frame with the same widgets has run, immediate mode gui frames including their rendering must not
+// touch the heap, false when they did
+template<typename F>
+bool check_gui_allocations(F &&ui) {
+	// over the side panel, so widgets that react to hovering are covered as well
+	glm::vec2 mouse = ursa::gui::mouse_position();
+	ursa::Rect screen = ursa::screenrect();
+	ursa::gui::handle_mousemove({ screen.right() - 100.0f, 150.0f });
+
+	// the first frame sets everything up, the second one runs with it in place
+	for (int i = 0; i < 2; i++) {
+		ursa::gui::frame_begin();
+		ui();
+		ursa::gui::frame_end();
 	}
-	// TODO horizontal scroll state, so it's possible to edit a line longer than window width
-	// TODO perhaps the line should be vertically centered inside the editing bounds
-	// TODO there should be an API for getting suggested height for the editline
-	RectList buildRects(ursa::FontAtlas::object_ref fonts, int fontIndex, glm::vec4 color, ursa::Rect bounds, ursa::Rect *cursorRect) {
-		RectList rects;
-		float x{ bounds.pos.x }, y{ bounds.pos.y };
-		float cursorx{ x };
-
-		const auto &fontInfo = fonts->fontInfo(fontIndex);
-		y += fontInfo.ascent;
-
-		for (size_t i = 0; i < line.length(); i++) {
-			const auto &ch = line[i];
-			auto info = fonts->glyphInfo(fontIndex, ch);
-			rects.addRect(info.bounds.offset(x, y), info.crop, color);
-			x += info.xadvance;
-			// rather than handling end-of-line case separately,
-			// just check if cursor is after the current glyph and leave the cursor=0 fall to default value
-			if (i+1 == cursor) {
-				cursorx = x;
-			}
-		}
 
-		// TODO hardcoded cursor width of 2 pixels is not necessarily a good thing
-		*cursorRect = {cursorx, bounds.pos.y, 2, fontInfo.ascent};
-
-		return rects;
+	t_allocations = 0;
+	t_counting = true;
+	for (int i = 0; i < 3; i++) {
+		ursa::gui::frame_begin();
+		ui();
+		ursa::gui::frame_end();
 	}
-private:
-	int cursor{0};
-	std::string line;
-};
+	t_counting = false;
+	ursa::gui::handle_mousemove(mouse);
+	if (t_allocations)
+		fprintf(stderr, "gui frames allocated %zu times\n", t_allocations);
+	return t_allocations == 0;
+}
 
 struct KeydownEvent {
 	SDL_Scancode scancode;
@@ -272,33 +91,33 @@ void keymod_update(SDL_Keymod *keymod, SDL_KeyboardEvent *e) {
 
 // unified text editing handler to make it easier to add line editing features later
 // TODO would it be better to have some keybind system for this stuff?
-bool editline_keydown_handler(EditLine *editline, const KeydownEvent &event) {
+bool editline_keydown_handler(ursa::text::Editor *editline, const KeydownEvent &event) {
 	switch (event.scancode) {
 	case SDL_SCANCODE_LEFT:
-		editline->offsetCursor(-1);
+		editline->move_cursor(-1);
 		return true;
 	case SDL_SCANCODE_RIGHT:
-		editline->offsetCursor(+1);
+		editline->move_cursor(+1);
 		return true;
 	case SDL_SCANCODE_A:
 		if (!event.ctrl())
 			return false;
 		/* fallthrough */
 	case SDL_SCANCODE_HOME:
-		editline->setCursor(0);
+		editline->move_home();
 		return true;
 	case SDL_SCANCODE_E:
 		if (!event.ctrl())
 			return false;
 		/* fallthrough */
 	case SDL_SCANCODE_END:
-		editline->setCursor(editline->length());
+		editline->move_end();
 		return true;
 	case SDL_SCANCODE_BACKSPACE:
-		editline->deleteOffset(-1);
+		editline->erase(-1);
 		return true;
 	case SDL_SCANCODE_DELETE:
-		editline->deleteOffset(+1);
+		editline->erase(+1);
 		return true;	
 	}
 	return false;
@@ -336,7 +155,11 @@ int main(int argc, char *argv[])
 
 	auto paneltex = ursa::texture(16, 16, panel_pixels);
 
-	auto tex = ursa::texture(R"(C:\Windows\Web\Wallpaper\Theme1\img1.jpg)");
+	// the wallpaper is big enough to stall startup, stream it in instead
+	ursa::TextureHandle tex = ursa::texture_async(R"(C:\Windows\Web\Wallpaper\Theme1\img1.jpg)", [&](ursa::TextureHandle loaded) {
+		if (loaded.handle)
+			tex = loaded;
+	});
 
 	std::vector<ursa::Vertex> ball;
 	for (int i = 0; i < 1000; i++) {
@@ -352,15 +175,20 @@ int main(int argc, char *argv[])
 	fonts->add_truetype(R"(c:\windows\fonts\comic.ttf)", 24.0f);
 	fonts->bake(512, 512);
 
-	TextBlock tb;
-	tb.appendLine("The quick brown fox jumps over the lazy dog");
-	tb.appendLine("Testing line gap code");
+	// scrolls with the mouse wheel, sticks to the bottom as lines are entered
+	ursa::text::View chatlog(fonts);
+	auto &tb = chatlog.layout();
+	tb.append_line("The quick brown fox jumps over the lazy dog");
+	tb.append_line("Testing line gap code");
 	tb.append("... just ", { 1.0f,1.0f,1.0f,1.0f }, 2);
-	tb.appendLine("Testing", { 1.0f, 0.3f, 0.8f, 1.0f }, 1);
-	tb.appendLine("Yatta!");
-	tb.appendLine("Isn't it amazing?", { 1.0f, 1.0f, 1.0f, 0.6f }, 3);
+	tb.append_line("Testing", { 1.0f, 0.3f, 0.8f, 1.0f }, 1);
+	tb.append_line("Yatta!");
+	tb.append_line("Isn't it amazing?", { 1.0f, 1.0f, 1.0f, 0.6f }, 3);
+
+	ursa::text::Editor editline(fonts, 0);
 
-	EditLine editline;
+	// static label, laid out once
+	ursa::Text title(fonts, 2, "Ursa testapp");
 
 	ursa::gui::set_default_font(fonts, 2);
 	ursa::gui::set_style("button", {
@@ -389,7 +217,34 @@ int main(int argc, char *argv[])
 		{ {1,1,1,1} },
 		});
 
+	auto gui = [&]() {
+		ursa::gui::panel_begin(ursa::gui::PanelEdge::right, 200);
+		ursa::gui::background(glm::vec4{0.5,0.5,0.5, 0.8f});
+		ursa::gui::padding(4);
+		ursa::gui::text("Just testing");
+		static bool tmp = false;
+		ursa::gui::checkbox("foo", &tmp);
+		ursa::gui::space(2);
+		if (ursa::gui::button(tmp ? "Turn off" : "Turn on"))
+			tmp = !tmp;
+		ursa::gui::space(2);
+		static size_t selected = 0;
+		ursa::gui::listbox("items", 100000, [](size_t i) {
+			static char item[32];
+			int length = snprintf(item, sizeof(item), "Item %zu", i);
+			return std::string_view(item, length);
+		}, &selected);
+		ursa::gui::panel_end();
+	};
+	bool guiChecked = false;
+
 	ursa::set_framefunc([&](float deltaTime) {
+		if (!guiChecked) {
+			if (!check_gui_allocations(gui))
+				exit(EXIT_FAILURE);
+			guiChecked = true;
+		}
+
 		ursa::clear({0.20f, 0.32f, 0.35f, 1.0f});
 		
 		ursa::transform_2d();
@@ -415,29 +270,17 @@ int main(int argc, char *argv[])
 		ursa::blend_enable();
 		ursa::draw_rect(textrect, { 0.0f,0.0f,0.0f,0.4f });
 		ursa::draw_rect(fonts->tex(), ursa::Rect(512, 512).alignRight(ursa::screenrect().right()), glm::vec4{0.5f, 0.5f, 1.0f, 0.5f});
-		RectList rects = tb.buildRects(fonts, textrect);
-		ursa::draw_rects(fonts->tex(), rects.rects.data(), rects.crops.data(), rects.colors.data(), rects.rects.size());
+		chatlog.draw(textrect);
 
-		ursa::Rect cursor;
 		ursa::draw_rect(inputrect, { 0.0f,0.0f,0.0f,0.4f });
-		rects = editline.buildRects(fonts, 0, glm::vec4{ 1.0f,1.0f,1.0f,1.0f }, inputrect, &cursor);
-		ursa::draw_rects(fonts->tex(), rects.rects.data(), rects.crops.data(), rects.colors.data(), rects.rects.size());
+		editline.draw(inputrect);
 		// TODO make the cursor blink
-		ursa::draw_rect(cursor, {0.8f,0.8f,0.8f,0.8f});
+		ursa::draw_rect(editline.cursor_rect(), {0.8f,0.8f,0.8f,0.8f});
 
-		ursa::draw_text(fonts,2, 2,2, "Ursa testapp");
+		title.draw(2, 2);
 
 		ursa::gui::frame_begin();
-		ursa::gui::panel_begin(ursa::gui::PanelEdge::right, 200);
-		ursa::gui::background(glm::vec4{0.5,0.5,0.5, 0.8f});
-		ursa::gui::padding(4);
-		ursa::gui::text("Just testing");
-		static bool tmp = false;
-		ursa::gui::checkbox("foo", &tmp);
-		ursa::gui::space(2);
-		if (ursa::gui::button(tmp ? "Turn off" : "Turn on"))
-			tmp = !tmp;
-		ursa::gui::panel_end();
+		gui();
 		ursa::gui::frame_end();
 
 		ursa::blend_disable();
@@ -445,6 +288,7 @@ int main(int argc, char *argv[])
 	});
 
 	auto events = std::make_shared<ursa::EventHandler>();
+	events->set_coalescing(true);
 	ursa::set_eventhandler(events);
 
 	SDL_StartTextInput();
@@ -464,6 +308,17 @@ int main(int argc, char *argv[])
 		ursa::gui::handle_mouseup({ event->x, event->y });
 	});
 
+	events->hook(SDL_MOUSEMOTION, [&](void *e) {
+		auto *event = static_cast<SDL_MouseMotionEvent*>(e);
+		ursa::gui::handle_mousemove({ event->x, event->y });
+	});
+
+	events->hook(SDL_MOUSEWHEEL, [&](void *e) {
+		auto *event = static_cast<SDL_MouseWheelEvent*>(e);
+		if (!ursa::gui::handle_mousewheel({ event->x, event->y }))
+			chatlog.scroll_by(-event->y * 40.0f);
+	});
+
 	events->hook(SDL_KEYUP, [&](void *e) {
 		auto *event = static_cast<SDL_KeyboardEvent*>(e);
 		keymod_update(&keymod, event);
@@ -480,7 +335,7 @@ int main(int argc, char *argv[])
 		editline_keydown_handler(&editline, kevent);
 
 		if (event->keysym.scancode == SDL_SCANCODE_RETURN) {
-			tb.appendLine(editline.contents());
+			tb.append_line(editline.contents());
 			editline.clear();
 		}
 	});